@@ -0,0 +1,274 @@
+/*
+        Description: 'git diff-tree' output parsing micro benchmark
+
+        Copyright: See COPYING file that comes with this distribution
+
+*/
+
+#include "common.h"
+#include "dataloader.h"
+#include "git.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <stdio.h>
+#include <stdlib.h>
+
+//
+// Parses synthetic 'git diff-tree -r --stdin' output, 1 to 8 modified
+// files per commit, or real output read from a file, delivered in 64KB
+// chunks as QProcess does. The old parser, that split QString lines and
+// interned QString names, is reproduced here as it was, the new one is
+// a real DiffTreeLoader. Data is fed before the loader thread starts, so
+// that its polling interval is not measured. Real output is the one of
+// the command used to load file names:
+//
+//    git rev-list --all | git diff-tree --no-color -r -C --stdin > out.txt
+//
+// Usage: bench_difftree [number of commits | file]
+//
+
+#define CHUNK_SIZE 65536
+
+static quint32 seed = 2463534242u;
+
+static quint32
+nextRand()
+{
+    seed ^= seed << 13;  // xorshift32, same sequence on every run
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static void
+appendSha( QByteArray& b )
+{
+    static const char hex[] = "0123456789abcdef";
+    char s[ 40 ];
+    for( int j = 0; j < 40; j += 8 )
+    {
+        quint32 r = nextRand();
+        for( int k = 0; k < 8; k++, r >>= 4 )
+            s[ j + k ] = hex[ r & 15 ];
+    }
+    b.append( s, 40 );
+}
+
+static const QByteArray
+diffTreeOutput( int n )
+{
+    QByteArray b;
+    for( int i = 0; i < n; i++ )
+    {
+        appendSha( b );
+        b.append( '\n' );
+        int files = 1 + nextRand() % 8;
+        for( int f = 0; f < files; f++ )
+        {
+            b.append( ":100644 100644 " );
+            appendSha( b );
+            b.append( ' ' );
+            appendSha( b );
+            b.append( " M\tsrc/module" );
+            b.append( QByteArray::number( nextRand() % 2000 ) );
+            b.append( "/file" );
+            b.append( QByteArray::number( nextRand() % 20000 ) );
+            b.append( ".cpp\n" );
+        }
+    }
+    return b;
+}
+
+//
+// Old GUI thread parser, only the fast path
+//
+struct OldParser
+{
+    QString pending;
+    StrVect shas;
+    QVector< RevFile* > files;
+    StrVect dirNamesVec, fileNamesVec;
+    QHash< QString, int > dirNamesMap, fileNamesMap;
+    QVector< int > rfDirs, rfNames;
+
+    ~OldParser() { qDeleteAll( files ); }
+
+    void flush();
+    void appendFileName( SCRef name );
+    void setExtStatus( SCRef rowSt );
+    void procReadyRead( const QByteArray& chunk );
+};
+
+static int
+internName( SCRef name, StrVect& vec, QHash< QString, int >& map )
+{
+    QHash< QString, int >::const_iterator it( map.constFind( name ) );
+    if( it != map.constEnd() )
+        return *it;
+
+    int idx = vec.count();
+    map.insert( name, idx );
+    vec.append( name );
+    return idx;
+}
+
+void
+OldParser::flush()
+{
+    if( files.isEmpty() )
+        return;
+
+    QByteArray& b = files.last()->pathsIdx;
+    b.resize( 2 * rfDirs.size() * sizeof( int ) );
+    int* d = ( int* )( b.data() );
+    for( int i = 0; i < rfDirs.size(); i++ )
+    {
+        d[ i ] = rfDirs.at( i );
+        d[ rfDirs.size() + i ] = rfNames.at( i );
+    }
+    rfDirs.clear();
+    rfNames.clear();
+}
+
+void
+OldParser::appendFileName( SCRef name )
+{
+    int idx = name.lastIndexOf( '/' ) + 1;
+    SCRef dr = name.left( idx );
+    SCRef nm = name.mid( idx );
+    rfDirs.append( internName( dr, dirNamesVec, dirNamesMap ) );
+    rfNames.append( internName( nm, fileNamesVec, fileNamesMap ) );
+}
+
+void
+OldParser::setExtStatus( SCRef rowSt )
+{
+    //
+    // Rename or copy, "Rxx\t<orig>\t<dest>"
+    //
+    const QStringList sl( rowSt.split( '\t', QString::SkipEmptyParts ) );
+    if( sl.count() != 3 )
+        return;
+
+    RevFile* rf = files.last();
+    const QString extStatusInfo( sl[ 1 ] + " --> " + sl[ 2 ] + " (" + sl[ 0 ] + "%)" );
+    appendFileName( sl[ 2 ] );
+    rf->mergeParent.append( 1 );
+    rf->status.append( RevFile::NEW );
+    rf->extStatus.resize( rf->status.size() );
+    rf->extStatus[ rf->status.size() - 1 ] = extStatusInfo;
+
+    if( sl[ 0 ].at( 0 ) == 'R' )
+    {
+        appendFileName( sl[ 1 ] );
+        rf->mergeParent.append( 1 );
+        rf->status.append( RevFile::DELETED );
+        rf->extStatus.resize( rf->status.size() );
+        rf->extStatus[ rf->status.size() - 1 ] = extStatusInfo;
+    }
+    rf->onlyModified = false;
+}
+
+void
+OldParser::procReadyRead( const QByteArray& chunk )
+{
+    pending.append( QString::fromUtf8( chunk ) );
+    int nextEOL = pending.indexOf( '\n' );
+    int lastEOL = -1;
+    while( nextEOL != -1 )
+    {
+        SCRef line( pending.mid( lastEOL + 1, nextEOL - lastEOL - 1 ) );
+        if( line.at( 0 ) != ':' )
+        {
+            flush();
+            shas.append( line.left( 40 ) );
+            files.append( new RevFile() );
+        }
+        else if( line.at( 98 ) == '\t' )
+        {
+            RevFile* rf = files.last();
+            appendFileName( line.mid( 99 ) );
+            rf->status.append( RevFile::MODIFIED );
+            rf->mergeParent.append( 1 );
+        }
+        else
+            setExtStatus( line.mid( 97 ) );
+        lastEOL = nextEOL;
+        nextEOL = pending.indexOf( '\n', lastEOL + 1 );
+    }
+    if( lastEOL != -1 )
+        pending.remove( 0, lastEOL + 1 );
+}
+
+int
+main( int argc, char* argv[] )
+{
+    QCoreApplication app( argc, argv );
+
+    int n = ( argc > 1 ? atoi( argv[ 1 ] ) : 200000 );
+    QByteArray out;
+    if( n > 0 )
+        out = diffTreeOutput( n );
+    else
+    {
+        QFile f( argv[ 1 ] );
+        if( !f.open( QIODevice::ReadOnly ) || ( out = f.readAll() ).isEmpty() )
+        {
+            printf( "Usage: %s [number of commits | file]\n", argv[ 0 ] );
+            return 1;
+        }
+    }
+    QList< QByteArray > chunks;
+    for( int ofs = 0; ofs < out.size(); ofs += CHUNK_SIZE )
+        chunks.append( out.mid( ofs, CHUNK_SIZE ) );
+
+    QElapsedTimer t;
+    t.start();
+    OldParser op;
+    FOREACH( QList< QByteArray >, it, chunks )
+    op.procReadyRead( *it );
+
+    op.flush();
+    qint64 oldMs = t.elapsed();
+
+    Git git( NULL );
+    DiffTreeLoader* dl = new DiffTreeLoader( &git );
+    t.restart();
+    FOREACH( QList< QByteArray >, it, chunks )
+    dl->procReadyRead( *it );
+
+    dl->procFinished();
+    dl->start();
+    int revs = 0, dirs = 0, files = 0;
+    FileNamesBatch* b;
+    for( bool done = false; !done; )
+    {
+        done = dl->isDone();  // Read before taking the last batches
+        while( ( b = dl->takeBatch() ) != NULL )
+        {
+            revs += b->files.count();
+            dirs += b->newDirs.count();
+            files += b->newFiles.count();
+            delete b;
+        }
+        if( !done )
+            dl->wait( 1 );
+    }
+    qint64 newMs = t.elapsed();
+    delete dl;
+
+    if( revs != op.files.count() || dirs != op.dirNamesVec.count() ||
+        files != op.fileNamesVec.count() )
+        printf( "ASSERT in main: parsers disagree, %d/%d revs, %d/%d dirs, %d/%d files\n",
+                op.files.count(), revs, op.dirNamesVec.count(), dirs, op.fileNamesVec.count(),
+                files );
+
+    printf( "%d commits, %d KB      QString   raw bytes\n", revs, out.size() >> 10 );
+    printf( "parse              %7lld ms %7lld ms  (%.1fx)\n", oldMs, newMs,
+            newMs ? ( double )oldMs / newMs : 0.0 );
+
+    return 0;
+}
@@ -0,0 +1,198 @@
+/*
+        Description: 'git log' records indexing micro benchmark
+
+        Copyright: See COPYING file that comes with this distribution
+
+*/
+
+#include "common.h"
+
+#include <QElapsedTimer>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+// Indexes a synthetic 'git log -z --log-size' stream, as loaded by
+// Git::startRevList(), one short log line per record. File history
+// records carry a diff of DIFF_LINES lines, whose terminating '\0' is
+// searched by Rev::indexData(). That search is timed first on its own,
+// with QByteArray::indexOf() it replaced and with memchr(), then
+// records are indexed by RevArena::newRev(), and their short log is
+// found on demand, as when painting. There is no bulk offsets pass to
+// compare with, see TODO.txt
+//
+// Usage: bench_revindex [number of records]
+//
+
+#define DIFF_LINES 60
+
+static quint32 seed = 2463534242u;
+
+static quint32
+nextRand()
+{
+    seed ^= seed << 13;  // xorshift32, same sequence on every run
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static void
+appendSha( QByteArray& b )
+{
+    static const char hex[] = "0123456789abcdef";
+    char s[ 40 ];
+    for( int j = 0; j < 40; j += 8 )
+    {
+        quint32 r = nextRand();
+        for( int k = 0; k < 8; k++, r >>= 4 )
+            s[ j + k ] = hex[ r & 15 ];
+    }
+    b.append( s, 40 );
+}
+
+static const QByteArray
+gitLogOutput( int n, bool withDiff )
+{
+    //
+    // Log size counts from the boundary marker to the end of the
+    // message, diff follows with its heading '\n', then the '\0'
+    //
+    QByteArray b, msg;
+    for( int i = 0; i < n; i++ )
+    {
+        msg = ">";
+        appendSha( msg );
+        msg.append( 'X' );
+        appendSha( msg );
+        msg.append( "X\nA U Thor<author@example.com>\nA U Thor<author@example.com>\n" );
+        msg.append( QByteArray::number( 1500000000 + i ) );
+        msg.append( "\nShort log of revision " );
+        msg.append( QByteArray::number( i ) );
+        msg.append( '\n' );
+
+        b.append( "log size " ).append( QByteArray::number( msg.size() ) ).append( '\n' );
+        b.append( msg );
+        if( withDiff )
+        {
+            b.append( "\ndiff --git a/src/file.cpp b/src/file.cpp\n" );
+            for( int l = 0; l < DIFF_LINES; l++ )
+            {
+                b.append( l & 1 ? "+" : "-" );
+                b.append( "    int value = compute( argument, " );
+                b.append( QByteArray::number( nextRand() ) );
+                b.append( " );\n" );
+            }
+        }
+        b.append( '\0' );
+    }
+    return b;
+}
+
+static qint64
+timeIndexOf( const QByteArray& ba, int* cnt )
+{
+    QElapsedTimer t;
+    t.start();
+    *cnt = 0;
+    for( int idx = ba.indexOf( '\0' ); idx != -1; idx = ba.indexOf( '\0', idx + 1 ) )
+        ( *cnt )++;
+
+    return t.elapsed();
+}
+
+static qint64
+timeMemchr( const QByteArray& ba, int* cnt )
+{
+    QElapsedTimer t;
+    t.start();
+    *cnt = 0;
+    const char* data = ba.constData();
+    const char* end = data + ba.size();
+    const char* p = data;
+    while( ( p = ( const char* )memchr( p, 0, end - p ) ) != NULL )
+    {
+        ( *cnt )++;
+        p++;
+    }
+    return t.elapsed();
+}
+
+static qint64
+timeNewRev( RevArena& arena, QVector< Rev* >& revs, const QByteArray& ba, bool withDiff )
+{
+    QElapsedTimer t;
+    t.start();
+    int ofs = 0, next;
+    while( ba.size() - ofs > 0 )
+    {
+        Rev* r = arena.newRev( ba, ofs, revs.count(), &next, withDiff );
+        if( next < 0 )
+        {
+            arena.release( r );
+            printf( "ASSERT in timeNewRev: bad record at %d\n", ofs );
+            break;
+        }
+        revs.append( r );
+        ofs = next;
+    }
+    return t.elapsed();
+}
+
+static qint64
+timeShortLog( const QVector< Rev* >& revs )
+{
+    QElapsedTimer t;
+    t.start();
+    int len = 0;
+    FOREACH( QVector< Rev* >, it, revs )
+    len += ( *it )->shortLog().size();
+
+    qint64 ms = t.elapsed();
+    if( !len )
+        printf( "ASSERT in timeShortLog: no short log found\n" );
+
+    return ms;
+}
+
+int
+main( int argc, char* argv[] )
+{
+    int n = ( argc > 1 ? atoi( argv[ 1 ] ) : 20000 );
+    if( n <= 0 )
+    {
+        printf( "Usage: %s [number of records]\n", argv[ 0 ] );
+        return 1;
+    }
+    //
+    // Rev::indexData() writes '\0' terminators in place, so
+    // the searches are timed before any record is indexed
+    //
+    QByteArray fileLog( gitLogOutput( n, true ) );
+    QByteArray mainLog( gitLogOutput( n, false ) );
+    int c1, c2;
+    qint64 i = timeIndexOf( fileLog, &c1 );
+    qint64 m = timeMemchr( fileLog, &c2 );
+    if( c1 != n || c2 != n )
+        printf( "ASSERT in main: %d/%d records found, %d expected\n", c1, c2, n );
+
+    printf( "%d records, %d MB with diff, %d bytes per Rev\n", n, fileLog.size() >> 20,
+            ( int )sizeof( Rev ) );
+    printf( "record ends, indexOf()  %7lld ms\n", i );
+    printf( "record ends, memchr()   %7lld ms\n", m );
+
+    RevArena arena;
+    QVector< Rev* > fileRevs, mainRevs;
+    fileRevs.reserve( n );
+    mainRevs.reserve( n );
+    printf( "index with diff         %7lld ms\n", timeNewRev( arena, fileRevs, fileLog, true ) );
+    printf( "index quick             %7lld ms\n", timeNewRev( arena, mainRevs, mainLog, false ) );
+    printf( "short log on demand     %7lld ms\n", timeShortLog( mainRevs ) );
+
+    if( fileRevs.count() != n || mainRevs.count() != n )
+        printf( "ASSERT in main: %d/%d records indexed, %d expected\n", fileRevs.count(),
+                mainRevs.count(), n );
+
+    return 0;
+}
@@ -0,0 +1,119 @@
+/*
+        Description: RevMap lookup micro benchmark
+
+        Copyright: See COPYING file that comes with this distribution
+
+*/
+
+#include "common.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <stdio.h>
+#include <stdlib.h>
+
+//
+// Compares RevMap with the QHash< ShaString, const Rev* > it replaced,
+// qHash() is still the 7 nibbles one used for non sha keys. Revisions
+// are never dereferenced, so fake pointers are used as values
+//
+// Usage: bench_revmap [number of shas]
+//
+
+static quint32 seed = 2463534242u;
+
+static quint32
+nextRand()
+{
+    seed ^= seed << 13;  // xorshift32, same sequence on every run
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static const Rev*
+fakeRev( int i )
+{
+    return reinterpret_cast< const Rev* >( ( quintptr )( i + 1 ) * 8 );
+}
+
+template< class Map >
+static qint64
+timeInsert( Map& m, const ShaVect& shas )
+{
+    QElapsedTimer t;
+    t.start();
+    for( int i = 0; i < shas.count(); i++ )
+        m.insert( shas.at( i ), fakeRev( i ) );
+
+    return t.elapsed();
+}
+
+template< class Map >
+static qint64
+timeLookup( const Map& m, const ShaVect& shas, const QVector< int >& order )
+{
+    QElapsedTimer t;
+    t.start();
+    int errors = 0;
+    for( int i = 0; i < order.count(); i++ )
+        if( m.value( shas.at( order.at( i ) ) ) != fakeRev( order.at( i ) ) )
+            errors++;
+
+    qint64 ms = t.elapsed();
+    if( errors )
+        printf( "ASSERT in timeLookup: %d wrong values\n", errors );
+
+    return ms;
+}
+
+int
+main( int argc, char* argv[] )
+{
+    int n = ( argc > 1 ? atoi( argv[ 1 ] ) : 1000000 );
+    if( n <= 0 )
+    {
+        printf( "Usage: %s [number of shas]\n", argv[ 0 ] );
+        return 1;
+    }
+    static const char hex[] = "0123456789abcdef";
+
+    QByteArray buf( n * 41, '\0' );
+    ShaVect shas;
+    shas.reserve( n );
+    for( int i = 0; i < n; i++ )
+    {
+        char* s = buf.data() + i * 41;
+        for( int j = 0; j < 40; j += 8 )
+        {
+            quint32 r = nextRand();
+            for( int k = 0; k < 8; k++, r >>= 4 )
+                s[ j + k ] = hex[ r & 15 ];
+        }
+        shas.append( ShaString( s ) );
+    }
+    QVector< int > loadOrder( n ), randomOrder( n );
+    for( int i = 0; i < n; i++ )
+        loadOrder[ i ] = randomOrder[ i ] = i;
+
+    for( int i = n - 1; i > 0; i-- )
+        qSwap( randomOrder[ i ], randomOrder[ nextRand() % ( i + 1 ) ] );
+
+    QHash< ShaString, const Rev* > hash;
+    RevMap revMap;
+
+    printf( "%d shas                QHash     RevMap\n", n );
+    qint64 h = timeInsert( hash, shas );
+    qint64 r = timeInsert( revMap, shas );
+    printf( "insert             %7lld ms %7lld ms\n", h, r );
+
+    h = timeLookup( hash, shas, loadOrder );
+    r = timeLookup( revMap, shas, loadOrder );
+    printf( "lookup load order  %7lld ms %7lld ms\n", h, r );
+
+    h = timeLookup( hash, shas, randomOrder );
+    r = timeLookup( revMap, shas, randomOrder );
+    printf( "lookup random      %7lld ms %7lld ms\n", h, r );
+
+    return 0;
+}
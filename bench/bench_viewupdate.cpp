@@ -0,0 +1,133 @@
+/*
+        Description: main view update cost micro benchmark
+
+        Copyright: See COPYING file that comes with this distribution
+
+*/
+
+#include <QAbstractItemModel>
+#include <QApplication>
+#include <QElapsedTimer>
+#include <QTreeView>
+#include <stdio.h>
+#include <stdlib.h>
+
+//
+// Loads rows in a shown QTreeView, set up as the main view, one batch
+// per GUI update as the data loader does. Each batch is announced with
+// a model reset, as FileHistory used to do, or with a rows insertion,
+// then events are processed so that the view lays out and paints.
+// Model data is generated, so only the view cost is measured
+//
+// Usage: bench_viewupdate [number of rows] [rows per batch]
+//
+// Without a display run with QT_QPA_PLATFORM=offscreen
+//
+
+#define COLUMNS 6
+
+class LoadModel : public QAbstractItemModel
+{
+    int rowCnt;
+
+public:
+    LoadModel() : rowCnt( 0 ) {}
+
+    void appendRows( int cnt, bool reset );
+
+    virtual QModelIndex index( int r, int c, const QModelIndex& par = QModelIndex() ) const
+    {
+        return ( !par.isValid() && r >= 0 && r < rowCnt && c >= 0 && c < COLUMNS
+                     ? createIndex( r, c )
+                     : QModelIndex() );
+    }
+    virtual QModelIndex parent( const QModelIndex& ) const { return QModelIndex(); }
+    virtual int rowCount( const QModelIndex& par = QModelIndex() ) const
+    {
+        return ( par.isValid() ? 0 : rowCnt );
+    }
+    virtual int columnCount( const QModelIndex& = QModelIndex() ) const { return COLUMNS; }
+    virtual QVariant data( const QModelIndex& idx, int role ) const
+    {
+        if( role != Qt::DisplayRole )
+            return QVariant();
+
+        return QString( "Row %1 column %2" ).arg( idx.row() ).arg( idx.column() );
+    }
+};
+
+void
+LoadModel::appendRows( int cnt, bool reset )
+{
+    if( reset )
+    {
+#if QT_VERSION >= 0x050000
+        beginResetModel();
+        rowCnt += cnt;
+        endResetModel();
+#else
+        rowCnt += cnt;
+        QAbstractItemModel::reset();
+#endif
+        return;
+    }
+    beginInsertRows( QModelIndex(), rowCnt, rowCnt + cnt - 1 );
+    rowCnt += cnt;
+    endInsertRows();
+}
+
+static qint64
+timeLoad( int rows, int batch, bool reset, qint64* slowest )
+{
+    LoadModel model;
+    QTreeView view;
+    view.setRootIsDecorated( false );
+    view.setUniformRowHeights( true );
+    view.setModel( &model );
+    view.resize( 800, 600 );
+    view.show();
+    QApplication::processEvents();
+
+    QElapsedTimer t, b;
+    t.start();
+    *slowest = 0;
+    for( int done = 0; done < rows; done += batch )
+    {
+        b.start();
+        model.appendRows( qMin( batch, rows - done ), reset );
+        if( done == 0 )
+            view.setCurrentIndex( model.index( 0, 0 ) );  // Kept only by insertions
+
+        QApplication::processEvents();
+        *slowest = qMax( *slowest, b.elapsed() );
+    }
+    qint64 ms = t.elapsed();
+    if( view.model()->rowCount() != rows )
+        printf( "ASSERT in timeLoad: %d rows shown, %d expected\n", view.model()->rowCount(),
+                rows );
+
+    return ms;
+}
+
+int
+main( int argc, char* argv[] )
+{
+    QApplication app( argc, argv );
+
+    int rows = ( argc > 1 ? atoi( argv[ 1 ] ) : 1000000 );
+    int batch = ( argc > 2 ? atoi( argv[ 2 ] ) : 10000 );
+    if( rows <= 0 || batch <= 0 )
+    {
+        printf( "Usage: %s [number of rows] [rows per batch]\n", argv[ 0 ] );
+        return 1;
+    }
+    qint64 resetSlowest, insertSlowest;
+    qint64 resetMs = timeLoad( rows, batch, true, &resetSlowest );
+    qint64 insertMs = timeLoad( rows, batch, false, &insertSlowest );
+
+    printf( "%d rows, %d per batch     reset    insert\n", rows, batch );
+    printf( "total              %7lld ms %7lld ms\n", resetMs, insertMs );
+    printf( "slowest batch      %7lld ms %7lld ms\n", resetSlowest, insertSlowest );
+
+    return 0;
+}
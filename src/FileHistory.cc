@@ -11,12 +11,17 @@
 
 #include <QApplication>
 #include <QDateTime>
+#include <QFile>
 #include <QFontMetrics>
+#include <QTimer>
 
 #include "lanes.h"
 
 #include "git.h"
 
+#define TEXT_CACHE_SIZE 4096  // rows
+#define LANES_BATCH 4096      // rows
+
 using namespace QGit;
 
 FileHistory::FileHistory( QObject* p, Git* g ) : QAbstractItemModel( p ), git( g )
@@ -27,7 +32,7 @@ FileHistory::FileHistory( QObject* p, Git* g ) : QAbstractItemModel( p ), git( g
                << "Author"
                << "Author Date";
     lns = new Lanes();
-    revs.reserve( QGit::MAX_DICT_SIZE );
+    flushingTail = lanesPending = false;
     clear();  // after _headerInfo is set
 
     connect( git, SIGNAL( newRevsAdded( const FileHistory*, const QVector< ShaString >& ) ),
@@ -103,66 +108,83 @@ FileHistory::sha( int row ) const
     return ( row < 0 || row >= rowCnt ? "" : QString( revOrder.at( row ) ) );
 }
 
+const Rev*
+FileHistory::rev( int row ) const
+{
+    return ( row < 0 || row >= rowCnt ? NULL : rowRevs.at( row ) );
+}
+
 void
 FileHistory::flushTail()
 {
-#if QT_VERSION >= 0x050000
-    beginResetModel();
-#endif
-
-    if( earlyOutputCnt < 0 || earlyOutputCnt >= revOrder.count() )
+    //
+    // Early output revisions are removed starting from the first one
+    // that does not match the final output, that will be appended in
+    // their place. Rows before it stay, together with the view state
+    // and the selection, so the model is not reset
+    //
+    if( earlyOutputCnt < 1 || earlyOutputCnt > revOrder.count() )
     {
         dbp( "ASSERT in FileHistory::flushTail(), earlyOutputCnt is %1", earlyOutputCnt );
         return;
     }
-    int cnt = revOrder.count() - earlyOutputCnt + 1;
-    while( cnt > 0 )
+    int first = earlyOutputCnt - 1;  // already moved past the mismatch
+    if( first < rowCnt )
+    {
+        flushingTail = true;
+        beginRemoveRows( QModelIndex(), first, rowCnt - 1 );
+    }
+    while( revOrder.count() > first )
     {
-        const ShaString& sha = revOrder.last();
-        const Rev* c = revs[ sha ];
-        delete c;
-        revs.remove( sha );
+        arena.release( const_cast< Rev* >( rowRevs.last() ) );
+        revs.remove( revOrder.last() );
         revOrder.pop_back();
-        cnt--;
+        rowRevs.pop_back();
     }
     // reset all lanes, will be redrawn
     for( int i = earlyOutputCntBase; i < revOrder.count(); ++i )
-    {
-        Rev* c = const_cast< Rev* >( revs[ revOrder[ i ] ] );
-        c->lanes.clear();
-    }
+        const_cast< Rev* >( rowRevs.at( i ) )->lanes.clear();
+
     firstFreeLane = earlyOutputCntBase;
     lns->clear();
-    rowCnt = revOrder.count();
+    clearTopology();
+    textCache.clear();
+    git->cancelLongLogs( this );  // It reads the removed revisions
+    longLogs.clear();
+    authorTimes.clear();
 
-#if QT_VERSION < 0x050000
-    reset();
-#else
-    endResetModel();
-#endif
+    if( flushingTail )
+    {
+        rowCnt = first;
+        endRemoveRows();
+        flushingTail = false;
+    }
+    scheduleLanes();  // Graph of the kept rows is computed again
 }
 
 void
 FileHistory::clear( bool complete )
 {
-#if QT_VERSION >= 0x050000
-    beginResetModel();
-#endif
-
     if( !complete )
     {
         if( revOrder.count() > 0 )
             flushTail();
-#if QT_VERSION >= 0x050000
-        endResetModel();
-#endif
         return;
     }
+#if QT_VERSION >= 0x050000
+    beginResetModel();
+#endif
     git->cancelDataLoading( this );
 
-    qDeleteAll( revs );
     revs.clear();
     revOrder.clear();
+    rowRevs.clear();
+    arena.clear();
+    clearTopology();
+    textCache.clear();
+    git->cancelLongLogs( this );
+    longLogs.clear();
+    authorTimes.clear();
     firstFreeLane = loadTime = earlyOutputCntBase = 0;
     setEarlyOutputState( false );
     lns->clear();
@@ -170,6 +192,8 @@ FileHistory::clear( bool complete )
     curFNames.clear();
     qDeleteAll( rowData );
     rowData.clear();
+    qDeleteAll( mappedFiles );  // unmap after rowData is gone
+    mappedFiles.clear();
 
     if( testFlag( REL_DATE_F ) )
     {
@@ -203,13 +227,50 @@ FileHistory::on_newRevsAdded( const FileHistory* fh, const QVector< ShaString >&
     if( !renamedRevs.isEmpty() || !renamedPatches.isEmpty() )
         return;
 
-    // do not attempt to insert 0 rows since the inclusive range would be invalid
-    if( rowCnt == shaVec.count() )
+    appendRows( shaVec.count() );
+}
+
+void
+FileHistory::appendRows( int cnt )
+{
+    //
+    // Only the new rows are announced, so the view keeps its
+    // state. Do not attempt to insert 0 rows since the inclusive
+    // range would be invalid
+    //
+    if( cnt <= rowCnt )
         return;
 
-    beginInsertRows( QModelIndex(), rowCnt, shaVec.count() - 1 );
-    rowCnt = shaVec.count();
+    beginInsertRows( QModelIndex(), rowCnt, cnt - 1 );
+    rowCnt = cnt;
     endInsertRows();
+    scheduleLanes();
+}
+
+void
+FileHistory::scheduleLanes()
+{
+    //
+    // Graph is never computed while painting, shown rows get their
+    // lanes in batches from the event loop, then they are repainted
+    //
+    if( !lanesPending && ( int )firstFreeLane < rowCnt )
+    {
+        lanesPending = true;
+        QTimer::singleShot( 0, this, SLOT( on_setLanes() ) );
+    }
+}
+
+void
+FileHistory::on_setLanes()
+{
+    lanesPending = false;
+    int first = firstFreeLane;
+    git->setLanes( this, qMin( rowCnt, first + LANES_BATCH ) );
+    if( ( int )firstFreeLane > first )
+        emit dataChanged( index( first, QGit::GRAPH_COL ),
+                          index( firstFreeLane - 1, QGit::GRAPH_COL ) );
+    scheduleLanes();
 }
 
 void
@@ -218,18 +279,15 @@ FileHistory::on_loadCompleted( const FileHistory* fh, const QString& )
     if( fh != this || rowCnt >= revOrder.count() )
         return;
 
-#if QT_VERSION < 0x050000
-    beginResetModel();
-#endif
-
-    // now we can process last revision
-    rowCnt = revOrder.count();
-// force a reset to avoid artifacts in file history graph under Windows
-#if QT_VERSION < 0x050000
-    reset();
-#else
-    endResetModel();
-#endif
+    //
+    // Now we can process last revisions, held back by renamed
+    // patches. Graph of rows already shown could have changed
+    // too, repaint it to avoid artifacts under Windows
+    //
+    int shownCnt = rowCnt;
+    appendRows( revOrder.count() );
+    if( shownCnt > 0 )
+        emit dataChanged( index( 0, QGit::GRAPH_COL ), index( shownCnt - 1, QGit::GRAPH_COL ) );
 
     // adjust Id column width according to the numbers of revisions we have
     if( !git->isMainHistory( this ) )
@@ -312,6 +370,118 @@ FileHistory::timeDiff( unsigned long secs ) const
     return tmp;
 }
 
+void
+FileHistory::appendRev( const ShaString& sha, const Rev* r )
+{
+    revOrder.append( sha );
+    rowRevs.append( r );
+}
+
+void
+FileHistory::clearTopology()
+{
+    parentsOfs.clear();
+    parentRows.clear();
+    childrenOfs.clear();
+    childRows.clear();
+    descRefsMaster.clear();
+    ancRefsMaster.clear();
+    descRefs.clear();
+    ancRefs.clear();
+    descBrnSet.clear();
+    brnSets.clear();
+    branchRows.clear();
+}
+
+bool
+FileHistory::rowText( int row, int col, QString& text ) const
+{
+    const Rev* r = ( row >= 0 && row < revOrder.count() ? revAt( row ) : NULL );
+    if( !r )
+        return false;
+
+    text = cachedText( row, r, col );
+    return true;
+}
+
+const QString
+FileHistory::cachedText( int row, const Rev* r, int col ) const
+{
+    if( col != QGit::LOG_COL && col != QGit::AUTH_COL && col != QGit::LOG_MSG_COL &&
+        col != QGit::TIME_COL )
+        return QString();
+
+    QHash< int, RowText >::iterator it( textCache.find( row ) );
+    if( it == textCache.end() )
+    {
+        if( textCache.count() >= TEXT_CACHE_SIZE )
+            evictText( row );
+
+        it = textCache.insert( row, RowText() );
+        ( *it ).shortLog = r->shortLog();
+        ( *it ).author = r->author();
+    }
+    if( col == QGit::LOG_COL )
+        return ( *it ).shortLog;
+
+    if( col == QGit::AUTH_COL )
+        return ( *it ).author;
+
+    if( col == QGit::TIME_COL )
+    {
+        if( ( *it ).date.isEmpty() )
+        {
+            quint32 t = authorTime( row, r );
+            ( *it ).date = ( secs != 0 ? timeDiff( secs - t )  // secs is 0 for absolute date
+                                       : git->getLocalDate( t ) );
+        }
+        return ( *it ).date;
+    }
+
+    if( !( *it ).hasLongLog )
+    {
+        const QString longLog( git->getLongLog( r, this ) );  // Starts reading if needed
+        if( git->isLongLogPending( r, this ) )
+            return QString();  // Not cached, filter runs again once read
+
+        ( *it ).longLog = longLog;
+        ( *it ).hasLongLog = true;
+    }
+    return ( *it ).longLog;
+}
+
+quint32
+FileHistory::authorTime( int row, const Rev* r ) const
+{
+    if( authorTimes.count() <= row )
+        authorTimes.resize( revOrder.count() );
+
+    quint32& t = authorTimes[ row ];
+    if( t == 0 )
+        t = r->authorTime();
+
+    return t;
+}
+
+void
+FileHistory::evictText( int row ) const
+{
+    //
+    // Keep only rows near the requested one, where the viewport or the
+    // filter scan is. At most half the cache survives, so a full sweep
+    // is done once every TEXT_CACHE_SIZE / 2 new rows at most
+    //
+    const int span = TEXT_CACHE_SIZE / 4;
+    QHash< int, RowText >::iterator it( textCache.begin() );
+    while( it != textCache.end() )
+    {
+        if( qAbs( it.key() - row ) > span )
+            it = textCache.erase( it );
+        else
+            ++it;
+    }
+}
+
 QVariant
 FileHistory::data( const QModelIndex& index, int role ) const
 {
@@ -320,32 +490,18 @@ FileHistory::data( const QModelIndex& index, int role ) const
     if( !index.isValid() || role != Qt::DisplayRole )
         return no_value;  // fast path, 90% of calls ends here!
 
-    const Rev* r = git->revLookup( revOrder.at( index.row() ), this );
-    if( !r )
-        return no_value;
+    const Rev* r = revAt( index.row() );
 
     int col = index.column();
 
-    // calculate lanes
-    if( r->lanes.count() == 0 )
-        git->setLane( r->sha(), const_cast< FileHistory* >( this ) );
-
     if( col == QGit::ANN_ID_COL )
         return ( annIdValid ? rowCnt - index.row() : QVariant() );
 
-    if( col == QGit::LOG_COL )
-        return r->shortLog();
-
-    if( col == QGit::AUTH_COL )
-        return r->author();
+    if( col == QGit::LOG_COL || col == QGit::AUTH_COL )
+        return cachedText( index.row(), r, col );
 
     if( col == QGit::TIME_COL && r->sha() != QGit::ZERO_SHA_RAW )
-    {
-        if( secs != 0 )  // secs is 0 for absolute date
-            return timeDiff( secs - r->authorDate().toULong() );
-        else
-            return git->getLocalDate( r->authorDate() );
-    }
+        return cachedText( index.row(), r, col );
 
     return no_value;
 }
@@ -18,6 +18,7 @@
 // class DataLoader;
 class Git;
 class Lanes;
+class QFile;
 
 class FileHistory : public QAbstractItemModel
 {
@@ -26,13 +27,53 @@ class FileHistory : public QAbstractItemModel
     friend class Annotate;
     friend class DataLoader;
     friend class Git;
+    friend class LongLogLoader;
+    friend class TreeIndexer;
 
     Git* git;
     RevMap revs;
+    RevArena arena;  // owns revs objects and merge split keys
     ShaVect revOrder;
     Lanes* lns;
     uint firstFreeLane;
     QList< QByteArray* > rowData;
+    QList< QFile* > mappedFiles;  // own the mappings rowData could point into
+
+    //
+    // Revisions by row, appended together with revOrder, so that
+    // rows are painted and walked with no sha lookup
+    //
+    QVector< const Rev* > rowRevs;
+
+    //
+    // Graph topology by row, filled by Git::indexTopology() when loading is
+    // complete. Parents of row i are parentRows[parentsOfs[i]..parentsOfs[i + 1]),
+    // -1 if not loaded, so that graph walks need no sha lookups
+    //
+    QVector< int > parentsOfs;
+    QVector< int > parentRows;
+    QVector< int > childrenOfs;  // same for children, ascending
+    QVector< int > childRows;
+
+    //
+    // Near refs by row, published by TreeIndexer. Many rows share the
+    // same descendant refs or ancestor refs, so these are stored only
+    // once, keyed by the row pointed by the xxxMaster column, -1 if none.
+    // Refs are stored as their row
+    //
+    QVector< int > descRefsMaster;
+    QVector< int > ancRefsMaster;
+    QHash< int, QVector< int > > descRefs;  // normally tags
+    QHash< int, QVector< int > > ancRefs;   // normally tags
+
+    //
+    // Descendant branches by row, as the id of a bitset in brnSets, -1 if
+    // none. Bit k stands for the branch at branchRows[k], each distinct
+    // set is stored once
+    //
+    QVector< int > descBrnSet;
+    QVector< QVector< uint > > brnSets;
+    QVector< int > branchRows;
     QList< QVariant > headerInfo;
     int rowCnt;
     bool annIdValid;
@@ -40,15 +81,45 @@ class FileHistory : public QAbstractItemModel
     int loadTime;
     int earlyOutputCnt;
     int earlyOutputCntBase;
+    bool flushingTail;
+    bool lanesPending;  // a lanes batch is queued, see scheduleLanes()
     QStringList fNames;
     QStringList curFNames;
     QStringList renamedRevs;
     QHash< QString, QString > renamedPatches;
 
+    //
+    // Display strings of the rows last painted or filtered, so that
+    // repaints and filtering again do not decode them each time. When
+    // full, rows far from the requested one are dropped first
+    //
+    struct RowText
+    {
+        RowText() : hasLongLog( false ) {}
+        QString shortLog;
+        QString author;
+        QString longLog;  // decoded only when searched
+        QString date;     // formatted only when shown
+        bool hasLongLog;
+    };
+    mutable QHash< int, RowText > textCache;
+    mutable QHash< const Rev*, QString > longLogs;  // fetched after loading, see Git::getLongLog()
+    mutable QVector< quint32 > authorTimes;  // by row, parsed when first needed, 0 if not yet
+
     void flushTail();
+    void appendRows( int cnt );
+    void scheduleLanes();
+    void clearTopology();
+    void appendRev( const ShaString& sha, const Rev* r );
+    bool isTopologyIndexed() const { return parentsOfs.count() == revOrder.count() + 1; }
+    const Rev* revAt( int row ) const { return rowRevs.at( row ); }
     const QString timeDiff( unsigned long secs ) const;
+    const QString cachedText( int row, const Rev* r, int col ) const;
+    quint32 authorTime( int row, const Rev* r ) const;
+    void evictText( int row ) const;
 
 private slots:
+    void on_setLanes();
     void on_newRevsAdded( const FileHistory*, const QVector< ShaString >& );
     void on_loadCompleted( const FileHistory*, const QString& );
 
@@ -58,11 +129,14 @@ public:
 
     void clear( bool complete = true );
     const QString sha( int row ) const;
+    const Rev* rev( int row ) const;
     int row( SCRef sha ) const;
     const QStringList fileNames() const;
     void resetFileNames( SCRef fn );
     void setEarlyOutputState( bool b = true );
     void setAnnIdValid( bool b = true );
+    bool isFlushingTail() const { return flushingTail; }
+    bool rowText( int row, int col, QString& text ) const;
 
 public:
     virtual QVariant data( const QModelIndex& index, int role ) const;
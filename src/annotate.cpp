@@ -857,7 +857,21 @@ Annotate::isDescendant( SCRef sha, SCRef target )
 
     int shaIdx = r->orderIdx;
     r = git->revLookup( target, fh );
+    if( !r )
+        return false;
 
+    if( fh->isTopologyIndexed() )
+    {
+        //
+        // Walk by row, no sha lookup needed
+        //
+        const QVector< int >& po = fh->parentsOfs;
+        int row = r->orderIdx;
+        while( row != -1 && row < shaIdx && po[ row + 1 ] - po[ row ] == 1 )
+            row = fh->parentRows[ po[ row ] ];
+
+        return ( row == shaIdx );
+    }
     while( r && r->orderIdx < shaIdx && r->parentsCount() == 1 )
     {
         r = git->revLookup( r->parent( 0 ), fh );
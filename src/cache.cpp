@@ -6,17 +6,524 @@
     Copyright: See COPYING file that comes with this distribution
 
 */
+#include <limits.h>
 #include <QDataStream>
 #include <QDir>
 #include <QFile>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QtEndian>
 
 #include "cache.h"
 
 using namespace QGit;
 
 Cache::Cache( QObject* par ) : QObject( par ) {}
+
+RevCache::~RevCache()
+{
+    arena.clear();
+    qDeleteAll( rowData );      // after revs that index into them
+    qDeleteAll( mappedFiles );  // unmap after rowData is gone
+}
+
+#define C_PAGE_SIZE 4096
+#define C_HEADER_SIZE 64
+#define C_JNL_HEADER_SIZE 48
+#define C_SHA_SIZE 20
+
+//
+// Journal is folded in the main file when it has more than
+// C_JNL_MIN_SIZE records and more than 1/C_JNL_MAX_RATIO of
+// the records of the main file
+//
+#define C_JNL_MIN_SIZE 10000
+#define C_JNL_MAX_RATIO 8
+
+//
+// File names cache is stored uncompressed, so that it can be mapped
+// and read in place. Block compression is deferred, see TODO.txt
+//
+#define C_LEGACY_VERSION 15  // qCompress()ed QDataStream
+
+//
+// Revisions cache sections are split in independent blocks,
+// compressed by a fast LZ77 codec and decoded in parallel
+//
+#define R_BLOCK_SIZE ( 1 << 20 )
+#define R_HASH_BITS 14
+#define R_MIN_MATCH 4
+#define R_MAX_OFFSET 65535
+
+//
+// File names cache flags, one per RevFile record
+//
+#define C_ONLY_MODIFIED 1
+#define C_MERGE_PARENT 2
+#define C_EXT_STATUS 4
+
+static inline quint32
+getU32( const uchar* p )
+{
+    return qFromLittleEndian< quint32 >( p );
+}
+
+static inline quint64
+getU64( const uchar* p )
+{
+    return qFromLittleEndian< quint64 >( p );
+}
+
+static inline void
+putU32( QByteArray& b, quint32 v )
+{
+    uchar d[ 4 ];
+    qToLittleEndian< quint32 >( v, d );
+    b.append( ( const char* )d, 4 );
+}
+
+static inline void
+putU64( QByteArray& b, quint64 v )
+{
+    uchar d[ 8 ];
+    qToLittleEndian< quint64 >( v, d );
+    b.append( ( const char* )d, 8 );
+}
+
+static inline void
+setU32( QByteArray& b, int ofs, quint32 v )
+{
+    qToLittleEndian< quint32 >( v, ( uchar* )b.data() + ofs );
+}
+
+static inline void
+padTo( QByteArray& b, int align )
+{
+    b.append( QByteArray( ( align - b.size() % align ) % align, '\0' ) );
+}
+
+static void
+putString( QByteArray& b, const QString& s )
+{
+    const QByteArray u( s.toUtf8() );
+    putU32( b, u.size() );
+    b.append( u );
+    padTo( b, 4 );
+}
+
+static inline int
+hexDigit( uchar ch )
+{
+    if( ( uint )( ch - '0' ) < 10 )
+        return ch - '0';
+
+    return ( ( uint )( ch - 'a' ) < 6 ? ch - 'a' + 10 : -1 );  // git uses lower case only
+}
+
+static bool
+toBinSha( const ShaString& sha, uchar* id )
+{
+    //
+    // Only plain shas can be stored, not custom or merge keys
+    //
+    const char* ch = sha.latin1();
+    if( !ch || sha.size() != 40 )
+        return false;
+
+    for( int i = 0; i < 40; i++ )
+    {
+        int v = hexDigit( ch[ i ] );
+        if( v == -1 )
+            return false;
+
+        if( i & 1 )
+            id[ i / 2 ] |= ( uchar )v;
+        else
+            id[ i / 2 ] = ( uchar )( v << 4 );
+    }
+    return true;
+}
+
+static void
+toHexSha( const uchar* id, char* sha )
+{
+    static const char hex[] = "0123456789abcdef";
+    for( int i = 0; i < C_SHA_SIZE; i++ )
+    {
+        sha[ 2 * i ] = hex[ id[ i ] >> 4 ];
+        sha[ 2 * i + 1 ] = hex[ id[ i ] & 15 ];
+    }
+    sha[ 40 ] = '\0';
+}
+
+bool
+FilesCache::open( const QString& gitDir, StrVect& dirs, StrVect& files )
+{
+    close();
+    file.setFileName( gitDir + C_DAT_FILE );
+    if( !file.open( QIODevice::ReadOnly ) )
+        return false;
+
+    dataSize = file.size();
+    data = ( dataSize >= C_HEADER_SIZE ? file.map( 0, dataSize ) : NULL );
+    if( !data || getU32( data ) != C_MAGIC || ( int )getU32( data + 4 ) != C_VERSION )
+    {
+        close();
+        return false;
+    }
+    quint64 n = getU32( data + 8 );
+    quint64 dirsNum = getU32( data + 12 );
+    quint64 filesNum = getU32( data + 16 );
+    quint64 idsOfs = getU64( data + 24 );
+    quint64 recOfsOfs = getU64( data + 32 );
+    quint64 strOfs = getU64( data + 40 );
+    quint64 recsOfs = getU64( data + 48 );
+    quint64 size = dataSize;
+
+    //
+    // Check sections fit in the file, offsets are checked before
+    // adding sizes to them so that a bogus one cannot wrap around
+    //
+    quint64 namesNum = dirsNum + filesNum;
+    bool ok = ( getU64( data + 56 ) == size && idsOfs <= size && recOfsOfs <= size &&
+                strOfs <= size && recsOfs <= size && n * C_SHA_SIZE <= size - idsOfs &&
+                ( n + 1 ) * 8 <= size - recOfsOfs && ( namesNum + 1 ) * 4 <= size - strOfs );
+
+    //
+    // Then every name and record offset, names and records must be
+    // in order and end within their section. This is a sequential
+    // read of the two offset tables only, the records are not read
+    //
+    const uchar* so = data + strOfs;
+    const char* str = ( const char* )( so + ( namesNum + 1 ) * 4 );
+    quint64 strSize = ( ok ? size - strOfs - ( namesNum + 1 ) * 4 : 0 );
+    for( quint64 i = 0; ok && i < namesNum; i++ )
+        ok = ( getU32( so + i * 4 ) <= getU32( so + ( i + 1 ) * 4 ) );
+
+    if( ok )
+        ok = ( getU32( so + namesNum * 4 ) <= strSize );
+
+    const uchar* ro = data + recOfsOfs;
+    for( quint64 i = 0; ok && i < n; i++ )
+        ok = ( getU64( ro + i * 8 ) <= getU64( ro + ( i + 1 ) * 8 ) );
+
+    if( ok )
+        ok = ( getU64( ro + n * 8 ) <= size - recsOfs && getU64( ro + n * 8 ) <= INT_MAX );
+
+    if( !ok )
+    {
+        dbs( "ASSERT in FilesCache::open, corrupted cache file" );
+        close();
+        return false;
+    }
+    revsCnt = ( int )n;
+    ids = data + idsOfs;
+    recOfs = ro;
+    recs = data + recsOfs;
+
+    dirs.resize( ( int )dirsNum );
+    for( int i = 0; i < dirs.count(); i++, so += 4 )
+        dirs[ i ] = QString::fromUtf8( str + getU32( so ), getU32( so + 4 ) - getU32( so ) );
+
+    files.resize( ( int )filesNum );
+    for( int i = 0; i < files.count(); i++, so += 4 )
+        files[ i ] = QString::fromUtf8( str + getU32( so ), getU32( so + 4 ) - getU32( so ) );
+
+    dirsCnt = dirs.count();
+    filesCnt = files.count();
+
+    //
+    // Journal is small, it is read whole
+    //
+    jnlValid = true;
+    QFile jf( gitDir + C_JNL_FILE );
+    if( jf.exists() )
+    {
+        jnlValid = jf.open( QIODevice::ReadOnly );
+        if( jnlValid )
+        {
+            jnl = jf.readAll();
+            jnlValid = readJournal( 0, &dirs, &files );
+        }
+    }
+    return true;
+}
+
+void
+FilesCache::close()
+{
+    file.close();  // Unmaps too
+    data = ids = recOfs = recs = NULL;
+    dataSize = 0;
+    revsCnt = dirsCnt = filesCnt = 0;
+    jnl.clear();
+    jnlIds.clear();
+    jnlOfs.clear();
+    jnlLen.clear();
+    jnlIdx.clear();
+    jnlValid = false;
+}
+
+bool
+FilesCache::readJournal( int ofs, StrVect* dirs, StrVect* files )
+{
+    //
+    // Each segment must extend the main file and the previous
+    // segments, parsing stops at the first one that does not.
+    // Names are decoded only if vectors are given
+    //
+    const uchar* base = ( const uchar* )jnl.constData();
+    while( ofs + C_JNL_HEADER_SIZE <= jnl.size() )
+    {
+        const uchar* p = base + ofs;
+        quint32 segSize = getU32( p + 40 );
+        if( getU32( p ) != J_MAGIC || ( int )getU32( p + 4 ) != C_VERSION ||
+            getU64( p + 8 ) != ( quint64 )dataSize || ( int )getU32( p + 16 ) != revsCnt ||
+            ( int )getU32( p + 20 ) != dirsCnt || ( int )getU32( p + 24 ) != filesCnt ||
+            segSize < C_JNL_HEADER_SIZE || segSize > ( quint32 )( jnl.size() - ofs ) )
+            break;
+
+        const uchar* end = p + segSize;
+        int newDirs = ( int )getU32( p + 28 );
+        int newFiles = ( int )getU32( p + 32 );
+        int n = ( int )getU32( p + 36 );
+        p += C_JNL_HEADER_SIZE;
+        for( int i = 0; i < newDirs + newFiles; i++ )
+        {
+            int len = ( p + 4 <= end ? ( int )getU32( p ) : -1 );
+            if( len < 0 || len > end - p - 4 )
+                return false;
+
+            p += 4;
+            if( dirs && files )
+                ( i < newDirs ? dirs : files )
+                    ->append( QString::fromUtf8( ( const char* )p, len ) );
+
+            ( i < newDirs ? dirsCnt : filesCnt )++;
+            p += ( len + 3 ) & ~3;
+        }
+        for( int i = 0; i < n; i++ )
+        {
+            int len = ( p + C_SHA_SIZE + 4 <= end ? ( int )getU32( p + C_SHA_SIZE ) : -1 );
+            if( len < 0 || len > end - p - C_SHA_SIZE - 4 )
+                return false;
+
+            const QByteArray id( ( const char* )p, C_SHA_SIZE );
+            p += C_SHA_SIZE + 4;
+            jnlIdx.insert( id, jnlOfs.count() );
+            jnlIds.append( id );
+            jnlOfs.append( p - base );
+            jnlLen.append( len );
+            p += len;
+        }
+        ofs += segSize;
+    }
+    return ( ofs == jnl.size() );
+}
+
+bool
+FilesCache::addJournal( const QByteArray& segment )
+{
+    int ofs = jnl.size();
+    jnl.append( segment );
+    jnlValid = readJournal( ofs, NULL, NULL ) && jnlValid;
+    return jnlValid;
+}
+
+int
+FilesCache::find( const ShaString& sha ) const
+{
+    uchar id[ C_SHA_SIZE ];
+    if( !data || !toBinSha( sha, id ) )
+        return -1;
+
+    int lo = 0, hi = revsCnt - 1;
+    while( lo <= hi )
+    {
+        int mid = ( lo + hi ) / 2;
+        int cmp = memcmp( ids + mid * C_SHA_SIZE, id, C_SHA_SIZE );
+        if( cmp == 0 )
+            return mid;
+
+        if( cmp < 0 )
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    if( jnlIdx.isEmpty() )
+        return -1;
+
+    int j = jnlIdx.value( QByteArray::fromRawData( ( const char* )id, C_SHA_SIZE ), -1 );
+    return ( j != -1 ? revsCnt + j : -1 );
+}
+
+const uchar*
+FilesCache::id( int idx ) const
+{
+    if( idx < revsCnt )
+        return ids + idx * C_SHA_SIZE;
+
+    return ( const uchar* )jnlIds.constData() + ( idx - revsCnt ) * C_SHA_SIZE;
+}
+
+const uchar*
+FilesCache::record( int idx, int* len ) const
+{
+    if( idx >= revsCnt )
+    {
+        *len = jnlLen.at( idx - revsCnt );
+        return ( const uchar* )jnl.constData() + jnlOfs.at( idx - revsCnt );
+    }
+    //
+    // Offsets have been checked by open()
+    //
+    quint64 start = getU64( recOfs + idx * 8 );
+    *len = ( int )( getU64( recOfs + ( idx + 1 ) * 8 ) - start );
+    return recs + start;
+}
+
+const uchar*
+FilesCache::paths( int idx, int* cnt ) const
+{
+    //
+    // Directory indices followed by file name indices, 32 bits
+    // little endian each, read in place with no RevFile built
+    //
+    int len;
+    const uchar* p = record( idx, &len );
+    *cnt = ( len >= 8 ? ( int )getU32( p ) : 0 );
+    if( 8 + ( quint64 )*cnt * 8 > ( quint64 )len )
+    {
+        dbp( "ASSERT in FilesCache::paths, corrupted record %1", idx );
+        *cnt = 0;
+    }
+    return p + 8;
+}
+
+const QByteArray
+FilesCache::rawRecord( int idx ) const
+{
+    int len;
+    const uchar* p = record( idx, &len );
+    return QByteArray::fromRawData( ( const char* )p, len );
+}
+
+RevFile*
+FilesCache::revFile( int idx ) const
+{
+    //
+    // Data is copied out of the mapping, so RevFile
+    // stays valid after the cache file is closed
+    //
+    int len;
+    const uchar* p = record( idx, &len );
+    const uchar* end = p + len;
+    RevFile* rf = new RevFile();
+    if( len < 8 || 8 + ( quint64 )getU32( p ) * 8 > ( quint64 )len )
+    {
+        dbp( "ASSERT in FilesCache::revFile, corrupted record %1", idx );
+        return rf;
+    }
+    int cnt = ( int )getU32( p );
+    quint32 flags = getU32( p + 4 );
+    p += 8;
+
+    rf->onlyModified = ( flags & C_ONLY_MODIFIED );
+    rf->pathsIdx.resize( 2 * cnt * ( int )sizeof( int ) );
+    int* d = ( int* )rf->pathsIdx.data();
+    for( int i = 0; i < 2 * cnt; i++, p += 4 )
+    {
+        d[ i ] = ( int )getU32( p );
+        if( d[ i ] < 0 || d[ i ] >= ( i < cnt ? dirsCnt : filesCnt ) )
+        {
+            dbp( "ASSERT in FilesCache::revFile, bad name index in record %1", idx );
+            rf->pathsIdx.clear();
+            return rf;
+        }
+    }
+
+    if( !rf->onlyModified && p + 4 <= end )
+    {
+        rf->status.resize( ( int )getU32( p ) );
+        p += 4;
+        for( int i = 0; i < rf->status.count() && p + 4 <= end; i++, p += 4 )
+            rf->status[ i ] = ( int )getU32( p );
+    }
+    if( ( flags & C_MERGE_PARENT ) && p + 4 <= end )
+    {
+        rf->mergeParent.resize( ( int )getU32( p ) );
+        p += 4;
+        for( int i = 0; i < rf->mergeParent.count() && p + 4 <= end; i++, p += 4 )
+            rf->mergeParent[ i ] = ( int )getU32( p );
+    }
+    if( ( flags & C_EXT_STATUS ) && p + 4 <= end )
+    {
+        int n = ( int )getU32( p );
+        p += 4;
+        for( int i = 0; i < n && p + 4 <= end; i++ )
+        {
+            int l = ( int )getU32( p );
+            p += 4;
+            if( p + l > end )
+                break;
+
+            rf->extStatus.append( QString::fromUtf8( ( const char* )p, l ) );
+            p += ( l + 3 ) & ~3;
+        }
+    }
+    return rf;
+}
+
+//-----------------------------------------------------------------------------
+
+void
+Cache::writeRecord( QByteArray& b, const RevFile& rf )
+{
+    //
+    // Same common cases are skipped as with RevFile streaming
+    //
+    bool hasMergeParent = !( rf.mergeParent.isEmpty() || rf.mergeParent.last() == 1 );
+    bool hasExtStatus = !rf.extStatus.isEmpty();
+    quint32 flags = ( rf.onlyModified ? C_ONLY_MODIFIED : 0 ) |
+                    ( hasMergeParent ? C_MERGE_PARENT : 0 ) | ( hasExtStatus ? C_EXT_STATUS : 0 );
+
+    putU32( b, rf.count() );
+    putU32( b, flags );
+    const int* d = ( const int* )rf.pathsIdx.constData();
+    for( int i = 0; i < 2 * rf.count(); i++ )
+        putU32( b, d[ i ] );
+
+    if( !rf.onlyModified )
+    {
+        putU32( b, rf.status.count() );
+        FOREACH( QVector< int >, it, rf.status )
+        putU32( b, *it );
+    }
+    if( hasMergeParent )
+    {
+        putU32( b, rf.mergeParent.count() );
+        FOREACH( QVector< int >, it, rf.mergeParent )
+        putU32( b, *it );
+    }
+    if( hasExtStatus )
+    {
+        putU32( b, rf.extStatus.count() );
+        FOREACH( QVector< QString >, it, rf.extStatus )
+        putString( b, *it );
+    }
+}
+
+struct CacheEntry
+{
+    uchar id[ C_SHA_SIZE ];
+    const RevFile* rf;  // NULL if record is copied from the old cache file
+    int cacheIdx;
+
+    bool operator<( const CacheEntry& e ) const { return memcmp( id, e.id, C_SHA_SIZE ) < 0; }
+};
+
 bool
-Cache::save( const QString& gitDir, const RevFileMap& rf, const StrVect& dirs,
+Cache::save( const QString& gitDir, const RevFileMap& rf, FilesCache& fc, const StrVect& dirs,
              const StrVect& files )
 {
     if( gitDir.isEmpty() || rf.isEmpty() )
@@ -32,111 +539,232 @@ Cache::save( const QString& gitDir, const RevFileMap& rf, const StrVect& dirs,
         return false;
     }
 
+    if( saveJournal( gitDir, rf, fc, dirs, files ) )
+        return true;
+
     QFile f( tmpPath );
-    if( !f.open( QIODevice::WriteOnly | QIODevice::Unbuffered ) )
+    if( !f.open( QIODevice::WriteOnly ) )
         return false;
 
     dbs( "Saving cache. Please wait..." );
 
-    // compress in memory before write to file
-    QByteArray data;
-    QDataStream stream( &data, QIODevice::WriteOnly );
-
-    // Write a header with a "magic number" and a version
-    stream << ( quint32 )C_MAGIC;
-    stream << ( qint32 )C_VERSION;
-
-    stream << ( qint32 )dirs.count();
-    for( int i = 0; i < dirs.count(); ++i )
-        stream << dirs.at( i );
-
-    stream << ( qint32 )files.count();
-    for( int i = 0; i < files.count(); ++i )
-        stream << files.at( i );
-
     //
-    // To achieve a better compression we save the sha's as
-    // one very long string instead of feeding the stream with
-    // each one. With this trick we gain a 15% size reduction
-    // in the final compressed file. The save/load speed is
-    // almost the same
+    // Records still in the old cache file, never looked up,
+    // are copied as they are. Custom and merge keys are skipped
     //
-    uint bufSize = rf.count() * 41 + 1000;  // a little bit more space then required
-
-    QByteArray buf;
-    buf.reserve( bufSize );
-
-    QVector< const RevFile* > v;
-    v.reserve( rf.count() );
-
-    QVector< QByteArray > ba;
-    ShaString CUSTOM_SHA_RAW( toPersistentSha( CUSTOM_SHA, ba ) );
-    unsigned int newSize = 0;
-
+    QVector< CacheEntry > v;
+    v.reserve( rf.count() + fc.count() );
+    CacheEntry e;
     FOREACH( RevFileMap, it, rf )
     {
-        const ShaString& sha = it.key();
-        if( sha == ZERO_SHA_RAW || sha == CUSTOM_SHA_RAW ||
-            sha.latin1()[ 0 ] == 'A' )  // ALL_MERGE_FILES + rev sha
+        if( it.key() == ZERO_SHA_RAW || !toBinSha( it.key(), e.id ) )
             continue;
 
-        v.append( it.value() );
-        buf.append( sha.latin1() ).append( '\0' );
-        newSize += 41;
-        if( newSize > bufSize )
-        {
-            dbs( "ASSERT in Cache::save, out of allocated space" );
-            return false;
-        }
+        e.rf = it.value();
+        e.cacheIdx = -1;
+        v.append( e );
     }
+    char buf[ 41 ];
+    for( int i = 0; i < fc.count(); i++ )
+    {
+        memcpy( e.id, fc.id( i ), C_SHA_SIZE );
+        toHexSha( e.id, buf );
+        if( rf.contains( ShaString( buf ) ) )
+            continue;
 
-    buf.resize( newSize );
-    stream << ( qint32 )newSize;
-    stream << buf;
+        e.rf = NULL;
+        e.cacheIdx = i;
+        v.append( e );
+    }
+    qSort( v );
 
-    for( int i = 0; i < v.size(); ++i )
-        *( v.at( i ) ) >> stream;
+    QByteArray idsSect, recOfsSect, strSect, recsSect;
+    idsSect.reserve( v.count() * C_SHA_SIZE );
+    recOfsSect.reserve( ( v.count() + 1 ) * 8 );
+    FOREACH( QVector< CacheEntry >, it, v )
+    {
+        idsSect.append( ( const char* )it->id, C_SHA_SIZE );
+        putU64( recOfsSect, recsSect.size() );
+        if( it->rf )
+            writeRecord( recsSect, *it->rf );
+        else
+            recsSect.append( fc.rawRecord( it->cacheIdx ) );
+    }
+    putU64( recOfsSect, recsSect.size() );
 
-    dbs( "Compressing data..." );
     //
-    // NOTE: no need to encode with compressed data
+    // Names string table, offsets first then UTF-8 data
     //
-    f.write( qCompress( data, 1 ) );
-    f.close();
+    QByteArray names;
+    FOREACH( StrVect, it, dirs )
+    {
+        putU32( strSect, names.size() );
+        names.append( it->toUtf8() );
+    }
+    FOREACH( StrVect, it, files )
+    {
+        putU32( strSect, names.size() );
+        names.append( it->toUtf8() );
+    }
+    putU32( strSect, names.size() );
+    strSect.append( names );
 
+    QByteArray header;
+    quint64 idsOfs = C_PAGE_SIZE;
+    quint64 recOfsOfs = idsOfs + ( idsSect.size() + C_PAGE_SIZE - 1 ) / C_PAGE_SIZE * C_PAGE_SIZE;
+    quint64 strOfs =
+        recOfsOfs + ( recOfsSect.size() + C_PAGE_SIZE - 1 ) / C_PAGE_SIZE * C_PAGE_SIZE;
+    quint64 recsOfs = strOfs + ( strSect.size() + C_PAGE_SIZE - 1 ) / C_PAGE_SIZE * C_PAGE_SIZE;
+    putU32( header, C_MAGIC );
+    putU32( header, C_VERSION );
+    putU32( header, v.count() );
+    putU32( header, dirs.count() );
+    putU32( header, files.count() );
+    putU32( header, 0 );  // Reserved
+    putU64( header, idsOfs );
+    putU64( header, recOfsOfs );
+    putU64( header, strOfs );
+    putU64( header, recsOfs );
+    putU64( header, recsOfs + recsSect.size() );
+    padTo( header, C_PAGE_SIZE );
+
+    padTo( idsSect, C_PAGE_SIZE );
+    padTo( recOfsSect, C_PAGE_SIZE );
+    padTo( strSect, C_PAGE_SIZE );
+
+    bool ok = ( f.write( header ) == header.size() && f.write( idsSect ) == idsSect.size() &&
+                f.write( recOfsSect ) == recOfsSect.size() &&
+                f.write( strSect ) == strSect.size() && f.write( recsSect ) == recsSect.size() );
+    f.close();
+    if( !ok )
+    {
+        dbs( "unable to write " + tmpPath );
+        dir.remove( tmpPath );
+        return false;
+    }
     //
-    // Rename C_DAT_FILE + BAK_EXT -> C_DAT_FILE
+    // Old file could be still mapped, release it before
+    // renaming C_DAT_FILE + BAK_EXT -> C_DAT_FILE, then
+    // map the new one. Journal is now folded in
     //
+    fc.close();
+    StrVect dummyDirs, dummyFiles;
     if( dir.exists( path ) )
     {
         if( !dir.remove( path ) )
         {
             dbs( "access denied to " + path );
             dir.remove( tmpPath );
+            fc.open( gitDir, dummyDirs, dummyFiles );
             return false;
         }
     }
 
     dir.rename( tmpPath, path );
+    dir.remove( gitDir + C_JNL_FILE );
+    fc.open( gitDir, dummyDirs, dummyFiles );
     dbs( "Done." );
     return true;
 }
 
 bool
-Cache::load( const QString& gitDir, RevFileMap& rfm, StrVect& dirs, StrVect& files,
-             QByteArray& revsFilesShaBuf )
+Cache::saveJournal( const QString& gitDir, const RevFileMap& rf, FilesCache& fc,
+                    const StrVect& dirs, const StrVect& files )
 {
     //
-    // Check for cache file
+    // Append new records and names to the journal, return
+    // false if the main file must be rewritten instead
     //
-    QString path( gitDir + C_DAT_FILE );
-    QFile f( path );
+    if( !fc.isOpen() || !fc.isJournalValid() || dirs.count() < fc.dirsCount() ||
+        files.count() < fc.filesCount() )
+        return false;
+
+    QVector< const RevFile* > newRevs;
+    QByteArray newIds;
+    uchar id[ C_SHA_SIZE ];
+    FOREACH( RevFileMap, it, rf )
+    {
+        if( it.key() == ZERO_SHA_RAW || !toBinSha( it.key(), id ) || fc.contains( it.key() ) )
+            continue;
+
+        newRevs.append( it.value() );
+        newIds.append( ( const char* )id, C_SHA_SIZE );
+    }
+    if( fc.journalCount() + newRevs.count() >
+        qMax( C_JNL_MIN_SIZE, fc.mainCount() / C_JNL_MAX_RATIO ) )
+        return false;  // Time to compact
+
+    if( newRevs.isEmpty() && dirs.count() == fc.dirsCount() && files.count() == fc.filesCount() )
+        return true;
+
+    QByteArray seg;
+    putU32( seg, J_MAGIC );
+    putU32( seg, C_VERSION );
+    putU64( seg, fc.size() );
+    putU32( seg, fc.mainCount() );
+    putU32( seg, fc.dirsCount() );
+    putU32( seg, fc.filesCount() );
+    putU32( seg, dirs.count() - fc.dirsCount() );
+    putU32( seg, files.count() - fc.filesCount() );
+    putU32( seg, newRevs.count() );
+    putU32( seg, 0 );  // Segment size, set below
+    putU32( seg, 0 );  // Reserved
+
+    for( int i = fc.dirsCount(); i < dirs.count(); i++ )
+        putString( seg, dirs[ i ] );
+
+    for( int i = fc.filesCount(); i < files.count(); i++ )
+        putString( seg, files[ i ] );
+
+    for( int i = 0; i < newRevs.count(); i++ )
+    {
+        seg.append( newIds.constData() + i * C_SHA_SIZE, C_SHA_SIZE );
+        int lenOfs = seg.size();
+        putU32( seg, 0 );
+        writeRecord( seg, *newRevs[ i ] );
+        setU32( seg, lenOfs, seg.size() - lenOfs - 4 );
+    }
+    setU32( seg, 40, seg.size() );
+
+    QFile f( gitDir + C_JNL_FILE );
+    if( !f.open( QIODevice::WriteOnly | QIODevice::Append ) )
+        return false;
+
+    bool ok = ( f.write( seg ) == seg.size() );
+    f.close();
+    if( !ok )
+    {
+        dbs( "unable to write file names cache journal" );
+        return false;  // Truncated segment is discarded by the rewrite
+    }
+    return fc.addJournal( seg );
+}
+
+bool
+Cache::load( const QString& gitDir, FilesCache& fc, StrVect& dirs, StrVect& files,
+             RevFileMap& rfm, QByteArray& revsFilesShaBuf )
+{
     //
     // No cache file is not an error
     //
-    if( !f.exists() )
+    if( !QFile::exists( gitDir + C_DAT_FILE ) )
         return true;
 
+    if( fc.open( gitDir, dirs, files ) )
+        return true;
+
+    //
+    // Files written by older versions are zlib compressed, they
+    // are read whole here, into rfm, and saved in the new format
+    //
+    return loadLegacy( gitDir + C_DAT_FILE, rfm, dirs, files, revsFilesShaBuf );
+}
+
+bool
+Cache::loadLegacy( const QString& path, RevFileMap& rfm, StrVect& dirs, StrVect& files,
+                   QByteArray& revsFilesShaBuf )
+{
+    QFile f( path );
     if( !f.open( QIODevice::ReadOnly | QIODevice::Unbuffered ) )
         return false;
 
@@ -146,15 +774,9 @@ Cache::load( const QString& gitDir, RevFileMap& rfm, StrVect& dirs, StrVect& fil
     qint32 dirsNum, filesNum, bufSize;
     stream >> magic;
     stream >> version;
-    if( magic != C_MAGIC || version != C_VERSION )
-    {
-        f.close();
+    if( magic != C_MAGIC || version != C_LEGACY_VERSION )
         return false;
-    }
 
-    //
-    // Read the data
-    //
     stream >> dirsNum;
     dirs.resize( dirsNum );
     for( int i = 0; i < dirsNum; ++i )
@@ -171,11 +793,30 @@ Cache::load( const QString& gitDir, RevFileMap& rfm, StrVect& dirs, StrVect& fil
     stream >> revsFilesShaBuf;
 
     const char* data = revsFilesShaBuf.constData();
+    const char* end = data + revsFilesShaBuf.size();
 
-    while( !stream.atEnd() )
+    while( !stream.atEnd() && data + 41 <= end )
     {
         RevFile* rf = new RevFile();
-        *rf << stream;
+        quint32 tmp;
+        stream >> rf->pathsIdx;
+
+        //
+        // Common cases of only modified files, just one
+        // parent and no rename/copies are skipped
+        //
+        stream >> tmp;
+        rf->onlyModified = ( bool )tmp;
+        if( !rf->onlyModified )
+            stream >> rf->status;
+
+        stream >> tmp;
+        if( !tmp )
+            stream >> rf->mergeParent;
+
+        stream >> tmp;
+        if( !tmp )
+            stream >> rf->extStatus;
 
         ShaString sha( data );
         rfm.insert( sha, rf );
@@ -183,12 +824,354 @@ Cache::load( const QString& gitDir, RevFileMap& rfm, StrVect& dirs, StrVect& fil
         data += 40;
         if( *data != '\0' )
         {
-            dbp( "ASSERT in Cache::load, corrupted SHA after %1", sha );
+            dbp( "ASSERT in Cache::loadLegacy, corrupted SHA after %1", sha );
             return false;
         }
         data++;
     }
+    return true;
+}
 
-    f.close();
+static inline quint32
+read32( const uchar* p )
+{
+    quint32 v;
+    memcpy( &v, p, 4 );
+    return v;
+}
+
+static inline uchar*
+putLength( uchar* op, int n )
+{
+    for( n -= 15; n >= 255; n -= 255 )
+        *op++ = 255;
+
+    *op++ = ( uchar )n;
+    return op;
+}
+
+static int
+lzBound( int len )
+{
+    return len + len / 255 + 16;
+}
+
+static int
+lzCompress( const uchar* src, int len, uchar* dst )
+{
+    //
+    // LZ77 with LZ4 like sequences: a token with literals length
+    // in the high nibble and match length minus R_MIN_MATCH in the
+    // low one, 15 meaning more length bytes follow, then literals,
+    // then 2 bytes little endian match offset. Last sequence has
+    // literals only. Matches are found by a 4 bytes hash, no chains
+    //
+    QVector< int > table( 1 << R_HASH_BITS, -1 );
+    const uchar* ip = src;
+    const uchar* anchor = src;
+    const uchar* end = src + len;
+    const uchar* limit = ( len > 12 ? end - 12 : src );  // Room for a match and a read32()
+    uchar* op = dst;
+
+    while( ip < limit )
+    {
+        quint32 v = read32( ip );
+        int& slot = table[ ( v * 2654435761u ) >> ( 32 - R_HASH_BITS ) ];
+        const uchar* ref = src + slot;
+        bool found = ( slot != -1 && ip - ref <= R_MAX_OFFSET && read32( ref ) == v );
+        slot = ip - src;
+        if( !found )
+        {
+            ip++;
+            continue;
+        }
+        const uchar* p = ip + R_MIN_MATCH;
+        for( ref += R_MIN_MATCH; p < end && *p == *ref; p++, ref++ )
+            ;
+
+        int litLen = ip - anchor;
+        int matchLen = p - ip - R_MIN_MATCH;
+        uchar* token = op++;
+        *token = ( uchar )( ( qMin( litLen, 15 ) << 4 ) | qMin( matchLen, 15 ) );
+        if( litLen >= 15 )
+            op = putLength( op, litLen );
+
+        memcpy( op, anchor, litLen );
+        op += litLen;
+        int offset = p - ref;
+        *op++ = ( uchar )offset;
+        *op++ = ( uchar )( offset >> 8 );
+        if( matchLen >= 15 )
+            op = putLength( op, matchLen );
+
+        ip = anchor = p;
+    }
+    int litLen = end - anchor;
+    *op++ = ( uchar )( qMin( litLen, 15 ) << 4 );
+    if( litLen >= 15 )
+        op = putLength( op, litLen );
+
+    memcpy( op, anchor, litLen );
+    return op + litLen - dst;
+}
+
+static bool
+getLength( const uchar*& ip, const uchar* end, int& n )
+{
+    uchar b;
+    do
+    {
+        if( ip >= end || n > INT_MAX - 255 )
+            return false;
+
+        b = *ip++;
+        n += b;
+    } while( b == 255 );
     return true;
 }
+
+static bool
+lzDecompress( const uchar* src, int len, uchar* dst, int dstLen )
+{
+    //
+    // Input is not trusted, every length and offset is checked
+    //
+    const uchar* ip = src;
+    const uchar* end = src + len;
+    uchar* op = dst;
+    uchar* oend = dst + dstLen;
+    while( ip < end )
+    {
+        int token = *ip++;
+        int litLen = token >> 4;
+        if( litLen == 15 && !getLength( ip, end, litLen ) )
+            return false;
+
+        if( litLen > end - ip || litLen > oend - op )
+            return false;
+
+        memcpy( op, ip, litLen );
+        ip += litLen;
+        op += litLen;
+        if( ip == end )
+            break;  // Last sequence
+
+        if( end - ip < 2 )
+            return false;
+
+        int offset = ip[ 0 ] | ( ip[ 1 ] << 8 );
+        ip += 2;
+        int matchLen = token & 15;
+        if( matchLen == 15 && !getLength( ip, end, matchLen ) )
+            return false;
+
+        matchLen += R_MIN_MATCH;
+        if( offset == 0 || offset > op - dst || matchLen > oend - op )
+            return false;
+
+        const uchar* ref = op - offset;
+        if( offset >= matchLen )
+            memcpy( op, ref, matchLen );
+        else
+            for( int i = 0; i < matchLen; i++ )  // Overlapping, repeats a pattern
+                op[ i ] = ref[ i ];
+
+        op += matchLen;
+    }
+    return ( op == oend );
+}
+
+//
+// Decodes one block of a section in its slice of the output,
+// blocks do not overlap so they can run in parallel
+//
+class BlockDecoder : public QRunnable
+{
+    QByteArray packed;
+    uchar* dst;
+    int dstLen;
+    QAtomicInt* failed;
+
+public:
+    BlockDecoder( const QByteArray& p, uchar* d, int len, QAtomicInt* f )
+        : packed( p ), dst( d ), dstLen( len ), failed( f )
+    {
+    }
+    virtual void run()
+    {
+        if( !lzDecompress( ( const uchar* )packed.constData(), packed.size(), dst, dstLen ) )
+            failed->storeRelease( 1 );
+    }
+};
+
+static bool
+writeBlocks( QDataStream& stream, const QByteArray& data )
+{
+    //
+    // Section size and blocks count, then each block as its packed
+    // size, 0 if stored as is because it does not shrink, and data
+    //
+    int cnt = ( data.size() + R_BLOCK_SIZE - 1 ) / R_BLOCK_SIZE;
+    stream << ( qint32 )data.size() << ( qint32 )cnt;
+
+    QByteArray buf( lzBound( R_BLOCK_SIZE ), '\0' );
+    for( int i = 0; i < cnt && stream.status() == QDataStream::Ok; i++ )
+    {
+        const uchar* src = ( const uchar* )data.constData() + i * R_BLOCK_SIZE;
+        int len = qMin( R_BLOCK_SIZE, data.size() - i * R_BLOCK_SIZE );
+        int packedLen = lzCompress( src, len, ( uchar* )buf.data() );
+        if( packedLen >= len )
+        {
+            stream << ( qint32 )0;
+            if( stream.writeRawData( ( const char* )src, len ) != len )
+                return false;
+        }
+        else
+        {
+            stream << ( qint32 )packedLen;
+            if( stream.writeRawData( buf.constData(), packedLen ) != packedLen )
+                return false;
+        }
+    }
+    return ( stream.status() == QDataStream::Ok );
+}
+
+static bool
+readBlocks( QDataStream& stream, QThreadPool& pool, QAtomicInt& failed, QByteArray& data )
+{
+    //
+    // Packed blocks are read in sequence, their decoding is queued
+    // on pool, caller waits for it before using data
+    //
+    qint32 size, cnt;
+    stream >> size >> cnt;
+    if( stream.status() != QDataStream::Ok || size < 0 ||
+        size / 256 > stream.device()->size() ||  // More than the codec can expand
+        cnt != ( qint32 )( ( ( qint64 )size + R_BLOCK_SIZE - 1 ) / R_BLOCK_SIZE ) )
+        return false;
+
+    data.resize( size );
+    for( int i = 0; i < cnt; i++ )
+    {
+        uchar* dst = ( uchar* )data.data() + i * R_BLOCK_SIZE;
+        int len = qMin( R_BLOCK_SIZE, size - i * R_BLOCK_SIZE );
+        qint32 packedLen;
+        stream >> packedLen;
+        if( packedLen == 0 )
+        {
+            if( stream.readRawData( ( char* )dst, len ) != len )
+                return false;
+
+            continue;
+        }
+        if( packedLen < 0 || packedLen > lzBound( len ) )
+            return false;
+
+        QByteArray packed( packedLen, '\0' );
+        if( stream.readRawData( packed.data(), packedLen ) != packedLen )
+            return false;
+
+        pool.start( new BlockDecoder( packed, dst, len, &failed ) );  // Auto-deleted
+    }
+    return true;
+}
+
+bool
+Cache::saveRevs( const QString& gitDir, const RevCache& rc )
+{
+    if( gitDir.isEmpty() || rc.revsData.isEmpty() )
+        return false;
+
+    QString path( gitDir + R_DAT_FILE );
+    QString tmpPath( path + BAK_EXT );
+
+    QDir dir;
+    if( !dir.exists( gitDir ) )
+    {
+        dbs( "Git directory not found, unable to save revisions cache" );
+        return false;
+    }
+
+    QFile f( tmpPath );
+    if( !f.open( QIODevice::WriteOnly ) )
+        return false;
+
+    //
+    // Records and lanes are the bulk of the file, they are block
+    // compressed so that load time is bound by disk speed
+    //
+    QDataStream stream( &f );
+    stream << ( quint32 )R_MAGIC;
+    stream << ( qint32 )R_VERSION;
+    stream << rc.key << rc.tips;
+    bool ok = writeBlocks( stream, rc.revsData );
+    stream << rc.lanesOfs;
+    ok = ok && writeBlocks( stream, rc.lanesData );
+    stream << rc.lanesState;
+    stream << ( qint32 )rc.firstRow << rc.lanesStart;
+    ok = ok && ( stream.status() == QDataStream::Ok );
+    f.close();  // Flushes
+
+    if( !ok || f.error() != QFileDevice::NoError )
+    {
+        //
+        // Disk full or similar, old cache is left alone
+        //
+        dbs( "unable to write " + tmpPath );
+        dir.remove( tmpPath );
+        return false;
+    }
+    if( dir.exists( path ) && !dir.remove( path ) )
+    {
+        dbs( "access denied to " + path );
+        dir.remove( tmpPath );
+        return false;
+    }
+    dir.rename( tmpPath, path );
+    return true;
+}
+
+bool
+Cache::loadRevs( const QString& gitDir, const QString& key, RevCache& rc )
+{
+    //
+    // Unlike file names cache, a missing or stale
+    // revisions cache simply means a full load
+    //
+    QFile f( gitDir + R_DAT_FILE );
+    if( !f.exists() || !f.open( QIODevice::ReadOnly ) )
+        return false;
+
+    QDataStream stream( &f );
+    quint32 magic;
+    qint32 version;
+    stream >> magic;
+    stream >> version;
+    if( magic != R_MAGIC || version != R_VERSION )
+        return false;
+
+    stream >> rc.key;
+    if( rc.key != key )
+        return false;
+
+    //
+    // Blocks of both sections are decoded while the file is read,
+    // pool destructor waits for them to finish, also on error
+    //
+    QThreadPool pool;
+    QAtomicInt failed( 0 );
+    stream >> rc.tips;
+    bool ok = readBlocks( stream, pool, failed, rc.revsData );
+    stream >> rc.lanesOfs;
+    ok = ok && readBlocks( stream, pool, failed, rc.lanesData );
+    stream >> rc.lanesState;
+
+    qint32 firstRow;
+    stream >> firstRow >> rc.lanesStart;
+    rc.firstRow = firstRow;
+    pool.waitForDone();
+    if( failed.loadAcquire() )
+        dbs( "ASSERT in Cache::loadRevs, corrupted revisions cache" );
+
+    return ( ok && !failed.loadAcquire() && stream.status() == QDataStream::Ok );
+}
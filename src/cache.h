@@ -7,8 +7,102 @@
 #ifndef CACHE_H
 #define CACHE_H
 
+#include <QFile>
+
 #include "git.h"
 
+struct RevCache
+{
+    RevCache() : firstRow( 0 ), lanesRows( 0 ), unsaved( false ) {}
+    ~RevCache();
+
+    //
+    // Parsed main history, raw 'git log' records are stored as
+    // they are, Rev objects index into them with no copies.
+    // Lanes are saved only for the leading rows where they have
+    // been already computed, together with the Lanes state needed
+    // to continue from there
+    //
+    QString key;            // loading arguments
+    QString tips;           // resolved loading arguments, one sha per line
+    QByteArray revsData;    // '\0' terminated 'git log' records, in load order
+    QVector< int > lanesOfs;  // start of each row in lanesData, plus end of last row
+    QByteArray lanesData;   // lane types, one byte each
+    QByteArray lanesState;  // streamed Lanes after the last row with lanes
+    QByteArray lanesStart;  // streamed Lanes before the first row
+
+    //
+    // On refresh the loaded history is kept in memory instead, Rev
+    // objects are reused as they are together with the buffers they
+    // index into, only row dependent data is updated when spliced
+    //
+    QVector< Rev* > revs;           // in load order, working directory rev excluded
+    RevArena arena;                 // owns revs
+    QList< QByteArray* > rowData;   // owned, Rev objects point into them
+    QList< QFile* > mappedFiles;    // owned, rowData could point into them
+    int firstRow;                   // row of the first revision when saved or kept
+    int lanesRows;                  // leading revs with lanes already computed
+    bool unsaved;                   // revisions cache on disk is not up to date
+};
+
+//
+// File names cache on disk, mapped and read in place. The file is made
+// of page aligned, little endian sections: sorted binary shas, record
+// offsets, names string table and RevFile records. Only the names are
+// decoded on open, a RevFile is built when first looked up, so open
+// time does not grow with history size.
+// New records and names are appended to a journal file instead, that
+// is read whole on open and folded in the main file when it grows too
+// much, see Cache::save()
+//
+class FilesCache
+{
+    QFile file;
+    const uchar* data;
+    qint64 dataSize;
+    int revsCnt;
+    const uchar* ids;     // 20 bytes binary shas, sorted
+    const uchar* recOfs;  // 64 bits offset of each record, plus end of last one
+    const uchar* recs;
+
+    QByteArray jnl;                   // journal file content
+    QByteArray jnlIds;                // 20 bytes binary shas, in journal order
+    QVector< int > jnlOfs;            // record offset in jnl
+    QVector< int > jnlLen;            // record length
+    QHash< QByteArray, int > jnlIdx;  // binary sha -> journal entry
+    int dirsCnt, filesCnt;            // names in main file and journal
+    bool jnlValid;
+
+    const uchar* record( int idx, int* len ) const;
+    bool readJournal( int ofs, StrVect* dirs, StrVect* files );
+
+public:
+    FilesCache()
+        : data( NULL ), dataSize( 0 ), revsCnt( 0 ), ids( NULL ), recOfs( NULL ), recs( NULL ),
+          dirsCnt( 0 ), filesCnt( 0 ), jnlValid( false )
+    {
+    }
+    ~FilesCache() { close(); }
+
+    bool open( const QString& gitDir, StrVect& dirs, StrVect& files );
+    void close();
+    bool isOpen() const { return data != NULL; }
+    int count() const { return revsCnt + journalCount(); }
+    int mainCount() const { return revsCnt; }
+    int journalCount() const { return jnlOfs.count(); }
+    bool isJournalValid() const { return jnlValid; }
+    int dirsCount() const { return dirsCnt; }
+    int filesCount() const { return filesCnt; }
+    qint64 size() const { return dataSize; }
+    int find( const ShaString& sha ) const;
+    bool contains( const ShaString& sha ) const { return find( sha ) != -1; }
+    RevFile* revFile( int idx ) const;
+    const uchar* paths( int idx, int* cnt ) const;
+    const QByteArray rawRecord( int idx ) const;
+    const uchar* id( int idx ) const;  // binary sha
+    bool addJournal( const QByteArray& segment );
+};
+
 class Cache : public QObject
 {
     Q_OBJECT
@@ -16,10 +110,19 @@ class Cache : public QObject
 public:
     explicit Cache( QObject* par );
 
-    static bool save( const QString& gitDir, const RevFileMap& rf, const StrVect& dirs,
-                      const StrVect& files );
-    static bool load( const QString& gitDir, RevFileMap& rf, StrVect& dirs, StrVect& files,
-                      QByteArray& revsFilesShaBuf );
+    static bool save( const QString& gitDir, const RevFileMap& rf, FilesCache& fc,
+                      const StrVect& dirs, const StrVect& files );
+    static bool load( const QString& gitDir, FilesCache& fc, StrVect& dirs, StrVect& files,
+                      RevFileMap& rfm, QByteArray& revsFilesShaBuf );
+    static bool saveRevs( const QString& gitDir, const RevCache& rc );
+    static bool loadRevs( const QString& gitDir, const QString& key, RevCache& rc );
+
+private:
+    static bool loadLegacy( const QString& path, RevFileMap& rfm, StrVect& dirs,
+                            StrVect& files, QByteArray& revsFilesShaBuf );
+    static void writeRecord( QByteArray& b, const RevFile& rf );
+    static bool saveJournal( const QString& gitDir, const RevFileMap& rf, FilesCache& fc,
+                             const StrVect& dirs, const StrVect& files );
 };
 
 #endif
@@ -9,6 +9,10 @@
 
 #include "common.h"
 
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <type_traits>
 #include <QDataStream>
 #include <QTextCodec>
 
@@ -18,9 +22,14 @@ Rev::mid( int start, int len ) const
     //
     // FIXME: no sanity check is done on arguments
     //
-    const char* data = ba.constData();
+    return decode( rec + start, len );
+}
+
+const QString
+Rev::decode( const char* data, int len )
+{
 #if QT_VERSION < 0x050000
-    return QString::fromAscii( data + start, len );
+    return QString::fromAscii( data, len );
 #else
     QTextCodec* codec = QTextCodec::codecForLocale();
     if( !codec )
@@ -28,7 +37,7 @@ Rev::mid( int start, int len ) const
         dbp( "ASSERT: local codec <%1> not available", 0 );
         return QString();
     }
-    return codec->toUnicode( data + start, len ).toUtf8();
+    return codec->toUnicode( data, len ).toUtf8();
 #endif
 }
 
@@ -38,25 +47,22 @@ Rev::midSha( int start, int len ) const
     //
     // FIXME: no sanity check is done on arguments
     //
-    const char* data = ba.constData();
-    //
     // NOTE: faster then fromAscii, and don't deprecated in Qt5
     //
-    return QString::fromLatin1( data + start, len );
+    return QString::fromLatin1( rec + start, len );
 }
 
-Rev::Rev( const QByteArray& b, uint s, int idx, int* next, bool withDiff )
-    : orderIdx( idx ), ba( b ), start( s )
+Rev::Rev( const QByteArray& b, uint s, int idx, int* next, bool wd )
+    : rec( b.constData() + s ), withDiff( wd ), orderIdx( idx )
 {
-    indexed = isDiffCache = isApplied = isUnApplied = false;
-    descRefsMaster = ancRefsMaster = descBrnMaster = -1;
-    *next = indexData( true, withDiff );
+    isDiffCache = isApplied = isUnApplied = false;
+    *next = indexData( b, s );
 }
 
 bool
 Rev::isBoundary() const
 {
-    return ( ba.at( shaStart - 1 ) == '-' );
+    return ( rec[ shaStart - 1 ] == '-' );
 }
 
 uint
@@ -68,7 +74,7 @@ Rev::parentsCount() const
 const ShaString
 Rev::parent( int idx ) const
 {
-    return ShaString( ba.constData() + shaStart + 41 + 41 * idx );
+    return ShaString( rec + shaStart + 41 + 41 * idx );
 }
 
 const QStringList
@@ -88,60 +94,133 @@ Rev::parents() const
 const ShaString
 Rev::sha() const
 {
-    return ShaString( ba.constData() + shaStart );
+    return ShaString( rec + shaStart );
 }
 
 const QString
 Rev::committer() const
 {
-    setup();
-    return mid( comStart, autStart - comStart - 1 );
+    Text t;
+    return ( indexText( t ) ? mid( t.comStart, t.autStart - t.comStart - 1 ) : QString() );
 }
 
 const QString
 Rev::author() const
 {
-    setup();
-    return mid( autStart, autDateStart - autStart - 1 );
+    Text t;
+    return ( indexText( t ) ? mid( t.autStart, t.autDateStart - t.autStart - 1 ) : QString() );
 }
 
 const QString
 Rev::authorDate() const
 {
-    setup();
-    return mid( autDateStart, 10 );
+    Text t;
+    return ( indexText( t ) ? mid( t.autDateStart, 10 ) : QString() );
+}
+
+uint
+Rev::authorTime() const
+{
+    Text t;
+    if( !indexText( t ) )
+        return 0;
+
+    const char* p = rec + t.autDateStart;
+    uint secs = 0;
+    while( *p >= '0' && *p <= '9' )
+        secs = secs * 10 + ( *p++ - '0' );
+
+    return secs;
 }
 
 const QString
 Rev::shortLog() const
 {
-    setup();
-    return mid( sLogStart, sLogLen );
+    Text t;
+    return ( indexText( t ) ? mid( t.sLogStart, t.sLogLen ) : QString() );
 }
 
 const QString
 Rev::longLog() const
 {
-    setup();
-    return mid( lLogStart, lLogLen );
+    Text t;
+    return ( indexText( t ) ? mid( t.lLogStart, t.lLogLen ) : QString() );
+}
+
+bool
+Rev::hasLongLog() const
+{
+    Text t;
+    return ( indexText( t ) && t.lLogLen > 0 );
 }
 
 const QString
 Rev::diff() const
 {
-    setup();
-    return mid( diffStart, diffLen );
+    Text t;
+    return ( indexText( t ) ? mid( t.diffStart, t.diffLen ) : QString() );
 }
 
-void
-Rev::setup() const
+const QByteArray
+Rev::rawData() const
+{
+    //
+    // The whole 'git log' record, including the terminating '\0'
+    //
+    return QByteArray( rec, revEnd + 1 );
+}
+
+//
+// QByteArray::indexOf() tests one byte at a time, memchr() is vectorized by
+// the C library (SSE2/AVX2 on x86, NEON on ARM) with a scalar fallback. Both
+// search in [from, end) only, so that a scan never runs past the record
+//
+static inline int
+findByte( const char* data, int from, int end, char ch )
+{
+    if( from >= end )
+        return -1;
+
+    const char* p = static_cast< const char* >( ::memchr( data + from, ch, end - from ) );
+    return ( p ? p - data : -1 );
+}
+
+static int
+findDiffHeader( const char* data, int from, int end, int size )
 {
-    if( !indexed )
-        indexData( false, false );
+    int idx;
+    while( ( idx = findByte( data, from, end, '\n' ) ) != -1 )
+    {
+        if( idx + 6 <= size && ::memcmp( data + idx, "\ndiff ", 6 ) == 0 )
+            return idx;
+
+        from = idx + 1;
+    }
+    return -1;
+}
+
+static bool
+isRecordStart( const char* data )
+{
+    //
+    // A record starts with 'log size' or with the boundary marker
+    // followed by an sha and the 'X' place holder. At least 42 bytes
+    // must be available, as checked by Rev::indexData()
+    //
+    if( ::memcmp( data, "log size ", 9 ) == 0 )
+        return true;
+
+    for( int i = 1; i <= 40; i++ )
+    {
+        uchar ch = data[ i ];
+        if( ( uint )( ch - '0' ) >= 10 && ( uint )( ch - 'a' ) >= 6 )
+            return false;
+    }
+    return ( data[ 41 ] == 'X' );
 }
 
 int
-Rev::indexData( bool quick, bool withDiff ) const
+Rev::indexData( const QByteArray& b, int start )
 {
     //
     //    This is what 'git log' produces:
@@ -159,30 +238,38 @@ Rev::indexData( bool quick, bool withDiff ) const
     //    - zero or more lines with diff content (only for file history)
     //    - a terminating '\0'
     //
+    // Only the sha line and the record end are indexed here, offsets
+    // are relative to the record start. Returns the offset in 'b' of
+    // the next record
+    //
     static int error = -1;
     static int shaLength = 40;                  // From git ref. spec.
     static int shaEndlLength = shaLength + 1;   // An sha key + \n
     static int shaXEndlLength = shaLength + 2;  // An sha key + X marker + \n
-    static char finalOutputMarker = 'F';        // Marks the beginning of "Final output" string
     static char logSizeMarker = 'l';            // Marks the beginning of "log size" string
     static int logSizeStrLength = 9;            // "log size"
     static int asciiPosOfZeroChar = 48;         // Char "0" has value 48 in ascii table
 
-    const int last = ba.size() - 1;
-    int logSize = 0, idx = start;
-    int logEnd, revEnd;
+    const int size = b.size() - start;  // From the record start
+    const int last = size - 1;
+    int logSize = 0, idx = 0;
 
     //
     // Direct access is faster then QByteArray.at()
     //
-    const char* data = ba.constData();
+    const char* data = rec;
     char* fixup = const_cast< char* >( data );  // To build '\0' terminating strings
 
-    if( start + shaXEndlLength > last )  // At least sha header must be present
+    if( shaXEndlLength > last )  // At least sha header must be present
         return -1;
 
-    if( data[ start ] == finalOutputMarker )  // "Final output", let caller handle this
-        return ( ba.indexOf( '\n', start ) != -1 ? -2 : -1 );
+    //
+    // Any other line is the "Final output" one of --early-output. Its
+    // text could be translated by git, so only its shape is checked,
+    // let caller handle it
+    //
+    if( !isRecordStart( data ) )
+        return ( findByte( data, 0, size, '\n' ) != -1 ? -2 : -1 );
 
     //
     // Parse   'log size xxx\n'   if present -- from git ref. spec.
@@ -242,7 +329,7 @@ Rev::indexData( bool quick, bool withDiff ) const
     if( withDiff || !logSize )
     {
         revEnd = ( logEnd > idx ) ? logEnd - 1 : idx;
-        revEnd = ba.indexOf( '\0', revEnd + 1 );
+        revEnd = findByte( data, revEnd + 1, size, '\0' );
         if( revEnd == -1 )
             return -1;
     }
@@ -252,200 +339,539 @@ Rev::indexData( bool quick, bool withDiff ) const
     if( revEnd > last )  // After this point we know to have the whole record
         return error;
 
+    return start + revEnd + 1;
+}
+
+bool
+Rev::indexText( Text& t ) const
+{
     //
-    // Ok, now revEnd is valid but logEnd could be not if !logSize
-    // in case of diff we are sure content will be consumed so
-    // we go all the way
+    // Full indexing, from the end of the sha line. Called by
+    // the accessors, nothing is stored, the lines before the
+    // log message are short
     //
-    if( quick && !withDiff )
-        return ++revEnd;
+    const char* data = rec;
+    ::memset( &t, 0, sizeof( t ) );
 
+    int idx = findByte( data, shaStart + 40, revEnd, '\n' );  // sha line end
+    if( idx == -1 )
+    {
+        dbs( "ASSERT in Rev::indexText: unexpected end of data" );
+        return false;
+    }
     //
     // Commiter
     //
-    comStart = ++idx;
-    idx = ba.indexOf( '\n', idx );  // committer line end
+    t.comStart = ++idx;
+    idx = findByte( data, idx, revEnd, '\n' );  // committer line end
     if( idx == -1 )
     {
-        dbs( "ASSERT in indexData: unexpected end of data" );
-        return -1;
+        dbs( "ASSERT in Rev::indexText: unexpected end of data" );
+        return false;
     }
 
     //
     // Author
     //
-    autStart = ++idx;
-    idx = ba.indexOf( '\n', idx );  // author line end
+    t.autStart = ++idx;
+    idx = findByte( data, idx, revEnd, '\n' );  // author line end
     if( idx == -1 )
     {
-        dbs( "ASSERT in indexData: unexpected end of data" );
-        return -1;
+        dbs( "ASSERT in Rev::indexText: unexpected end of data" );
+        return false;
     }
 
     //
     // Author date in Unix format (seconds since epoch)
     //
-    autDateStart = ++idx;
-    idx = ba.indexOf( '\n', idx );  // author date end without '\n'
+    t.autDateStart = ++idx;
+    idx = findByte( data, idx, revEnd, '\n' );  // author date end without '\n'
     if( idx == -1 )
     {
-        dbs( "ASSERT in indexData: unexpected end of data" );
-        return -1;
+        dbs( "ASSERT in Rev::indexText: unexpected end of data" );
+        return false;
     }
     //
     // If no error, point to trailing \n
     //
     ++idx;
 
-    diffStart = diffLen = 0;
+    bool hasLogSize = ( logEnd >= shaStart );
+    int end = logEnd;
     if( withDiff )
     {
-        diffStart = logSize ? logEnd : ba.indexOf( "\ndiff ", idx );
+        t.diffStart = hasLogSize ? logEnd : findDiffHeader( data, idx, revEnd, revEnd + 1 );
 
-        if( diffStart != -1 && diffStart < revEnd )
-            diffLen = revEnd - ++diffStart;
+        if( t.diffStart != -1 && t.diffStart < revEnd )
+            t.diffLen = revEnd - ++t.diffStart;
         else
-            diffStart = 0;
+            t.diffStart = 0;
     }
-    if( !logSize )
-        logEnd = diffStart ? diffStart : revEnd;
+    if( !hasLogSize )
+        end = t.diffStart ? t.diffStart : revEnd;
 
     //
-    // Ok, now logEnd is valid and we can handle the log
+    // Ok, now end is valid and we can handle the log
     //
-    sLogStart = idx;
+    t.sLogStart = idx;
 
-    if( logEnd < sLogStart )
+    if( end < t.sLogStart )
     {
         //
         // No shortlog no longLog
         //
-        sLogStart = sLogLen = 0;
-        lLogStart = lLogLen = 0;
+        t.sLogStart = t.sLogLen = 0;
+        t.lLogStart = t.lLogLen = 0;
     }
     else
     {
-        lLogStart = ba.indexOf( '\n', sLogStart );
-        if( lLogStart != -1 && lLogStart < logEnd - 1 )
+        t.lLogStart = findByte( data, t.sLogStart, end, '\n' );
+        if( t.lLogStart != -1 && t.lLogStart < end - 1 )
         {
-            sLogLen = lLogStart - sLogStart;  // Skip sLog trailing '\n'
-            lLogLen = logEnd - lLogStart;     // Include heading '\n' in long log
+            t.sLogLen = t.lLogStart - t.sLogStart;  // Skip sLog trailing '\n'
+            t.lLogLen = end - t.lLogStart;          // Include heading '\n' in long log
         }
         else
         {
             //
             // no longLog
             //
-            sLogLen = logEnd - sLogStart;
-            if( data[ sLogStart + sLogLen - 1 ] == '\n' )
-                sLogLen--;  // Skip trailing '\n' if any
+            t.sLogLen = end - t.sLogStart;
+            if( t.sLogLen > 0 && data[ t.sLogStart + t.sLogLen - 1 ] == '\n' )
+                t.sLogLen--;  // Skip trailing '\n' if any
 
-            lLogStart = lLogLen = 0;
+            t.lLogStart = t.lLogLen = 0;
         }
     }
-    indexed = true;
-    return ++revEnd;
+    return true;
 }
 
-RevFile::RevFile() : onlyModified( true ) {}
+//-----------------------------------------------------------------------------
 
 int
-RevFile::dirAt( uint idx ) const
+RevLanes::keySize() const
 {
-    return ( ( int* )pathsIdx.constData() )[ idx ];
+    int len = 0;
+    if( key )
+        ::memcpy( &len, key, sizeof( int ) );  // Not aligned
+
+    return len;
 }
 
 int
-RevFile::nameAt( uint idx ) const
+RevLanes::at( int pos ) const
 {
-    return ( ( int* )pathsIdx.constData() )[ count() + idx ];
+    if( patch )
+        for( int i = 1, sz = patch[ 0 ] + 1; i < sz; i += 3 )
+            if( ( patch[ i ] | ( patch[ i + 1 ] << 8 ) ) == pos )
+                return patch[ i + 2 ];
+
+    return ( pos < keySize() ? key[ sizeof( int ) + pos ] : EMPTY );
 }
 
-int
-RevFile::count() const
+void
+RevLanes::clear()
 {
-    return pathsIdx.size() / ( ( int )sizeof( int ) * 2 );
+    key = NULL;  // Storage is freed with the arena
+    patch = NULL;
+    cnt = 0;
 }
 
-bool
-RevFile::statusCmp( int idx, RevFile::StatusFlag sf ) const
+void
+RevLanes::append( int type, RevArena& arena )
 {
-    return ( ( onlyModified ? MODIFIED : status.at( idx ) ) & sf );
+    QByteArray row( decode() );
+    row.append( ( char )type );
+    assign( row, RevLanes(), arena );
 }
 
-const QString
-RevFile::extendedStatus( int idx ) const
+void
+RevLanes::assign( const QByteArray& row, const RevLanes& prev, RevArena& arena )
 {
     //
-    //   rf.extStatus has size equal to position of latest copied/renamed file,
-    //   that could be lower then count(), so we have to explicitly check for
-    //   an out of bound condition
+    // Diff against the key row of the previous row, when too many
+    // columns changed the row becomes a new key row on its own.
+    // Patch entries are column (little endian 16 bits) and type
     //
-    return ( !extStatus.isEmpty() && idx < extStatus.count() ? extStatus.at( idx ) : "" );
+    const int MAX_PATCH = 8;
+    char buf[ MAX_PATCH * 3 ];
+    const char* r = row.constData();
+    const char* k = ( prev.key ? prev.key + sizeof( int ) : NULL );
+    int kCnt = prev.keySize(), len = 0;
+    bool newKey = ( kCnt == 0 || row.size() > 0xFFFF );
+
+    cnt = row.size();
+    for( int i = 0; i < cnt && !newKey; i++ )
+    {
+        if( r[ i ] == ( i < kCnt ? k[ i ] : ( char )EMPTY ) )
+            continue;
+
+        if( len == MAX_PATCH * 3 )
+        {
+            newKey = true;
+            break;
+        }
+        buf[ len++ ] = ( char )( i & 0xFF );
+        buf[ len++ ] = ( char )( i >> 8 );
+        buf[ len++ ] = r[ i ];
+    }
+    if( newKey )
+    {
+        char* p = arena.alloc( sizeof( int ) + cnt );
+        ::memcpy( p, &cnt, sizeof( int ) );
+        ::memcpy( p + sizeof( int ), r, cnt );
+        key = p;
+        patch = NULL;
+        return;
+    }
+    key = prev.key;
+    if( len == 0 )
+        patch = NULL;
+    else if( prev.patch && len == prev.patch[ 0 ] && memcmp( buf, prev.patch + 1, len ) == 0 )
+        patch = prev.patch;
+    else
+    {
+        uchar* p = ( uchar* )arena.alloc( len + 1 );
+        p[ 0 ] = ( uchar )len;
+        ::memcpy( p + 1, buf, len );
+        patch = p;
+    }
 }
 
-//
-// RevFile streaming out
-//
-const RevFile&
-RevFile::operator>>( QDataStream& stream ) const
+const QByteArray
+RevLanes::decode() const
+{
+    int kCnt = qMin( keySize(), cnt );
+    QByteArray row( cnt, ( char )EMPTY );
+    if( kCnt > 0 )
+        ::memcpy( row.data(), key + sizeof( int ), kCnt );
+
+    if( patch )
+        for( int i = 1, sz = patch[ 0 ] + 1; i < sz; i += 3 )
+            row[ patch[ i ] | ( patch[ i + 1 ] << 8 ) ] = ( char )patch[ i + 2 ];
+
+    return row;
+}
+
+//-----------------------------------------------------------------------------
+
+static_assert( std::is_trivially_destructible< Rev >::value, "Rev must own no memory" );
+
+#define ARENA_MIN_REVS 64
+#define ARENA_MAX_REVS 4096
+#define ARENA_STR_BLOCK 16384
+
+Rev*
+RevArena::newRev( const QByteArray& b, uint s, int idx, int* next, bool withDiff )
 {
-    stream << pathsIdx;
+    if( !freeRevs.isEmpty() )
+    {
+        Rev* r = freeRevs.last();
+        freeRevs.pop_back();
+        return new( r ) Rev( b, s, idx, next, withDiff );  // Nothing to destroy
+    }
+    if( revBlocks.isEmpty() || revBlocks.last().used == revBlocks.last().size )
+    {
+        //
+        // Blocks double the capacity up to a limit, so that a parser
+        // batch of ARENA_MAX_REVS revisions fills its blocks exactly
+        //
+        Block bl;
+        bl.size = qBound( ARENA_MIN_REVS, revsCapacity, ARENA_MAX_REVS );
+        bl.mem = ( char* )::malloc( bl.size * sizeof( Rev ) );
+        bl.used = 0;
+        revBlocks.append( bl );
+        revsCapacity += bl.size;
+    }
+    Block& bl = revBlocks.last();
+    void* slot = bl.mem + bl.used++ * sizeof( Rev );
+    return new( slot ) Rev( b, s, idx, next, withDiff );
+}
 
+void
+RevArena::release( Rev* r )
+{
     //
-    // Skip common case of only modified files
+    // The last allocated slot is given back, with its block when
+    // empty, so that revisions released in reverse load order, as
+    // by FileHistory::flushTail(), are all given back. Any other
+    // slot is reused by newRev(). Lanes storage is not given back,
+    // it is freed by clear()
     //
-    bool isEmpty = onlyModified;
-    stream << ( quint32 )isEmpty;
-    if( !isEmpty )
-        stream << status;
+    if( !revBlocks.isEmpty() )
+    {
+        Block& bl = revBlocks.last();
+        if( bl.used > 0 && ( char* )r == bl.mem + ( bl.used - 1 ) * sizeof( Rev ) )
+        {
+            if( --bl.used == 0 )
+            {
+                revsCapacity -= bl.size;
+                ::free( bl.mem );
+                revBlocks.pop_back();
+            }
+            return;
+        }
+    }
+    r->lanes.clear();
+    freeRevs.append( r );
+}
 
+char*
+RevArena::alloc( int len )
+{
     //
-    // Skip common case of just one parent
+    // Bytes with no alignment, for strings and lanes
     //
-    isEmpty = ( mergeParent.isEmpty() || mergeParent.last() == 1 );
-    stream << ( quint32 )isEmpty;
-    if( !isEmpty )
-        stream << mergeParent;
+    if( strBlocks.isEmpty() || strBlocks.last().size - strBlocks.last().used < len )
+    {
+        Block bl;
+        bl.size = qMax( ARENA_STR_BLOCK, len );
+        bl.mem = ( char* )::malloc( bl.size );
+        bl.used = 0;
+        strBlocks.append( bl );
+    }
+    Block& bl = strBlocks.last();
+    char* p = bl.mem + bl.used;
+    bl.used += len;
+    return p;
+}
+
+const ShaString
+RevArena::newSha( const QString& sha )
+{
+    const QByteArray ba( sha.toLatin1() );
+    int len = ba.size() + 1;  // with '\0'
+    char* p = alloc( len );
+    ::memcpy( p, ba.constData(), len );
+    return ShaString( p );
+}
+
+void
+RevArena::take( RevArena& other )
+{
+    revBlocks << other.revBlocks;
+    strBlocks << other.strBlocks;
+    freeRevs << other.freeRevs;
+    revsCapacity += other.revsCapacity;
+    other.revBlocks.clear();
+    other.strBlocks.clear();
+    other.freeRevs.clear();
+    other.revsCapacity = 0;
+}
+
+void
+RevArena::clear()
+{
+    FOREACH( QVector< Block >, it, revBlocks )
+    ::free( ( *it ).mem );  // No destructor to run, see static_assert above
+
+    FOREACH( QVector< Block >, it, strBlocks )
+    ::free( ( *it ).mem );
+
+    revBlocks.clear();
+    strBlocks.clear();
+    freeRevs.clear();
+    revsCapacity = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+static inline int
+hexDigit( uchar ch )
+{
+    if( ( uint )( ch - '0' ) < 10 )
+        return ch - '0';
+
+    return ( ( uint )( ch - 'a' ) < 6 ? ch - 'a' + 10 : -1 );  // git uses lower case only
+}
+
+bool
+RevMap::toId( const ShaString& sha, quint32* id )
+{
+    const uchar* ch = reinterpret_cast< const uchar* >( sha.latin1() );
+    if( !ch )
+        return false;
+
+    uchar* b = reinterpret_cast< uchar* >( id );
+    for( int i = 0; i < 20; i++, ch += 2 )
+    {
+        int hi = hexDigit( ch[ 0 ] );
+        if( hi < 0 )
+            return false;  // Stop at '\0' too
+
+        int lo = hexDigit( ch[ 1 ] );
+        if( lo < 0 )
+            return false;
 
+        b[ i ] = ( uchar )( ( hi << 4 ) | lo );
+    }
+    return ( *ch == '\0' );  // A longer key is not a sha
+}
+
+int
+RevMap::find( const quint32* id ) const
+{
     //
-    // Skip common case of no rename/copies
+    // Linear probing, table is never more than half full so an
+    // empty slot is always reached. Returns the slot with the
+    // given id or the empty one where it should be inserted
     //
-    isEmpty = extStatus.isEmpty();
-    stream << ( quint32 )isEmpty;
-    if( !isEmpty )
-        stream << extStatus;
+    const quint32* t = table.constData();
+    const ObjectId* d = ids.constData();
+    uint mask = table.count() - 1;
+    uint i = id[ 0 ] & mask;
+    while( t[ i ] && memcmp( d[ t[ i ] - 1 ].w, id, sizeof( ObjectId ) ) )
+        i = ( i + 1 ) & mask;
 
-    return *this;
+    return i;
 }
 
-//
-// RevFile streaming in
-//
-RevFile&
-RevFile::operator<<( QDataStream& stream )
+void
+RevMap::rehash( int size )
+{
+    table.fill( 0, size );  // size must be a power of 2
+    for( int k = 0; k < ids.count(); k++ )
+        table[ find( ids.at( k ).w ) ] = k + 1;
+}
+
+const Rev*
+RevMap::value( const ShaString& sha ) const
+{
+    quint32 id[ 5 ];
+    if( !toId( sha, id ) )
+        return ( sha.latin1() ? others.value( sha ) : NULL );
+
+    if( table.isEmpty() )
+        return NULL;
+
+    quint32 k = table.at( find( id ) );
+    return ( k ? revs.at( k - 1 ) : NULL );
+}
+
+void
+RevMap::insert( const ShaString& sha, const Rev* rev )
 {
-    stream >> pathsIdx;
+    ObjectId id;
+    if( !toId( sha, id.w ) )
+    {
+        others.insert( sha, rev );
+        return;
+    }
+    if( 2 * ( revs.count() + 1 ) > table.count() )
+        rehash( qMax( 2 * table.count(), 1024 ) );
 
-    bool isEmpty;
-    quint32 tmp;
+    quint32& k = table[ find( id.w ) ];
+    if( k )
+    {
+        revs[ k - 1 ] = rev;
+        return;
+    }
+    ids.append( id );
+    revs.append( rev );
+    k = revs.count();
+}
 
-    stream >> tmp;
-    onlyModified = ( bool )tmp;
-    if( !onlyModified )
-        stream >> status;
+const Rev*
+RevMap::take( const ShaString& sha )
+{
+    quint32 id[ 5 ];
+    if( !toId( sha, id ) )
+        return ( sha.latin1() ? others.take( sha ) : NULL );
 
-    stream >> tmp;
-    isEmpty = ( bool )tmp;
-    if( !isEmpty )
-        stream >> mergeParent;
+    if( table.isEmpty() )
+        return NULL;
 
-    stream >> tmp;
-    isEmpty = ( bool )tmp;
-    if( !isEmpty )
-        stream >> extStatus;
+    quint32* t = table.data();
+    uint mask = table.count() - 1;
+    uint i = find( id );
+    if( !t[ i ] )
+        return NULL;
 
-    return *this;
+    int k = t[ i ] - 1;
+    const Rev* rev = revs.at( k );
+
+    //
+    // No tombstones, following slots of the same cluster are moved
+    // back if the emptied one lies between them and their home slot
+    //
+    for( uint j = ( i + 1 ) & mask; t[ j ]; j = ( j + 1 ) & mask )
+    {
+        uint home = ids.at( t[ j ] - 1 ).w[ 0 ] & mask;
+        if( ( ( j - home ) & mask ) >= ( ( j - i ) & mask ) )
+        {
+            t[ i ] = t[ j ];
+            i = j;
+        }
+    }
+    t[ i ] = 0;
+
+    //
+    // Keep arrays dense moving the last entry in the hole
+    //
+    int last = revs.count() - 1;
+    if( k != last )
+    {
+        ids[ k ] = ids.at( last );
+        revs[ k ] = revs.at( last );
+        t[ find( ids.at( k ).w ) ] = k + 1;
+    }
+    ids.removeLast();
+    revs.removeLast();
+    return rev;
+}
+
+const QVector< const Rev* >
+RevMap::values() const
+{
+    return ( others.isEmpty() ? revs : revs + others.values().toVector() );
+}
+
+void
+RevMap::clear()
+{
+    table.clear();
+    ids.clear();
+    revs.clear();
+    others.clear();
+}
+
+//-----------------------------------------------------------------------------
+
+RevFile::RevFile() : onlyModified( true ) {}
+
+int
+RevFile::dirAt( uint idx ) const
+{
+    return ( ( int* )pathsIdx.constData() )[ idx ];
+}
+
+int
+RevFile::nameAt( uint idx ) const
+{
+    return ( ( int* )pathsIdx.constData() )[ count() + idx ];
+}
+
+int
+RevFile::count() const
+{
+    return pathsIdx.size() / ( ( int )sizeof( int ) * 2 );
+}
+
+bool
+RevFile::statusCmp( int idx, RevFile::StatusFlag sf ) const
+{
+    return ( ( onlyModified ? MODIFIED : status.at( idx ) ) & sf );
+}
+
+const QString
+RevFile::extendedStatus( int idx ) const
+{
+    //
+    //   rf.extStatus has size equal to position of latest copied/renamed file,
+    //   that could be lower then count(), so we have to explicitly check for
+    //   an out of bound condition
+    //
+    return ( !extStatus.isEmpty() && idx < extStatus.count() ? extStatus.at( idx ) : "" );
 }
 
 //-----------------------------------------------------------------------------
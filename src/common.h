@@ -329,10 +329,18 @@ bool startProcess( QProcess* proc, SCList args, SCRef buf = "", bool* winShell =
 
 // cache file
 const uint C_MAGIC = 0xA0B0C0D0;
-const int C_VERSION = 15;
+const uint J_MAGIC = 0xA0B0C0D2;  // cache journal segments
+const int C_VERSION = 16;
 
 extern const QString BAK_EXT;
 extern const QString C_DAT_FILE;
+extern const QString C_JNL_FILE;
+
+// revisions cache file
+const uint R_MAGIC = 0xA0B0C0D1;
+const int R_VERSION = 4;
+
+extern const QString R_DAT_FILE;
 
 // misc
 const int MAX_DICT_SIZE = 100003;  // must be a prime number see QDict docs
@@ -354,26 +362,68 @@ struct ShaString : public QLatin1String
     }
 };
 
+class RevArena;
+
+//
+// Graph lanes of a revision, one byte per lane type. Most rows differ from
+// the row above only in a couple of columns, so a row is stored as a key
+// row, shared by all the rows that follow it, plus a short patch of
+// (column, type) entries. Equal consecutive patches are shared too. Both
+// are allocated in the RevArena of the history, so that lanes own no
+// memory. Rows are decoded on demand, see decode()
+//
+class RevLanes
+{
+    const char* key;     // length as an int then the row, shared with the neighbour rows
+    const uchar* patch;  // length byte then 3 bytes entries, see assign(), NULL if none
+    int cnt;
+
+    int keySize() const;
+
+public:
+    RevLanes() : key( NULL ), patch( NULL ), cnt( 0 ) {}
+
+    int count() const { return cnt; }
+    bool isEmpty() const { return cnt == 0; }
+    int at( int pos ) const;
+    int operator[]( int pos ) const { return at( pos ); }
+    void clear();
+    void append( int type, RevArena& arena );
+    void assign( const QByteArray& row, const RevLanes& prev, RevArena& arena );
+    const QByteArray decode() const;
+};
+
 class Rev
 {
-    const QByteArray& ba;  // reference here!
-    const int start;
-    mutable int parentsCnt, shaStart, comStart, autStart, autDateStart;
-    mutable int sLogStart, sLogLen, lLogStart, lLogLen, diffStart, diffLen;
-    mutable bool indexed;
+    //
+    // Only the offsets found by the quick indexing of the constructor
+    // are stored, relative to the record start. The other fields are
+    // found on demand by indexText(), a scan of a few short lines
+    //
+    struct Text
+    {
+        int comStart, autStart, autDateStart;
+        int sLogStart, sLogLen, lLogStart, lLogLen, diffStart, diffLen;
+    };
+    const char* rec;  // record start, in a buffer owned by the history
+    int shaStart, parentsCnt;
+    int logEnd;       // lower than shaStart if 'log size' is missing
+    int revEnd;       // terminating '\0'
+    bool withDiff;
 
     // prevent implicit C++ compiler defaults
     Rev();
     Rev( const Rev& );
     Rev& operator=( const Rev& );
 
-    inline void setup() const;
-    int indexData( bool quick, bool withDiff ) const;
+    int indexData( const QByteArray& b, int start );
+    bool indexText( Text& t ) const;
     const QString mid( int start, int len ) const;
     const QString midSha( int start, int len ) const;
 
 public:
     bool isDiffCache, isApplied, isUnApplied;  // put here to optimize padding
+    int orderIdx;
 
 public:
     Rev( const QByteArray& b, uint s, int idx, int* next, bool withDiff );
@@ -386,26 +436,96 @@ public:
     const QString committer() const;
     const QString author() const;
     const QString authorDate() const;
+    uint authorTime() const;
     const QString shortLog() const;
     const QString longLog() const;
+    bool hasLongLog() const;
     const QString diff() const;
+    const QByteArray rawData() const;
+    static const QString decode( const char* data, int len );
 
-    QVector< int > lanes, children;
-    QVector< int > descRefs;      // list of descendant refs index, normally tags
-    QVector< int > ancRefs;       // list of ancestor refs index, normally tags
-    QVector< int > descBranches;  // list of descendant branches index
-    int descRefsMaster;           // in case of many Rev have the same descRefs, ancRefs or
-    int ancRefsMaster;            // descBranches these are stored only once in a Rev pointed
-    int descBrnMaster;            // by corresponding index xxxMaster
-    int orderIdx;
+    RevLanes lanes;
+};
+
+//
+// Rev objects of a history, and the sha strings and lanes that must live as
+// long as them, are bump allocated in blocks owned by the history, so that
+// loading does no allocation per revision and clearing frees a handful of
+// blocks, with no destructor run: a Rev owns no memory.
+// Revisions parsed out of the GUI thread are built in an arena of their
+// own, whose blocks are handed over to the history with take()
+//
+class RevArena
+{
+    struct Block
+    {
+        char* mem;
+        int used;  // Rev slots, or bytes for strings
+        int size;
+    };
+    QVector< Block > revBlocks;
+    QVector< Block > strBlocks;
+    QVector< Rev* > freeRevs;  // released slots, not the last one, see release()
+    int revsCapacity;
+
+    // prevent implicit C++ compiler defaults
+    RevArena( const RevArena& );
+    RevArena& operator=( const RevArena& );
+
+public:
+    RevArena() : revsCapacity( 0 ) {}
+    ~RevArena() { clear(); }
+
+    Rev* newRev( const QByteArray& b, uint s, int idx, int* next, bool withDiff );
+    void release( Rev* r );
+    char* alloc( int len );
+    const ShaString newSha( const QString& sha );
+    void take( RevArena& other );
+    void clear();
+};
+
+//
+// Revisions are looked up by sha several times per painted row, so
+// they are stored keyed by the 20 bytes binary object id, in dense
+// arrays indexed by a flat open addressing table, with no per node
+// allocations. Sha is already a very good hash, so its first 4 bytes
+// are used directly. Keys that are not a plain sha, as 'git log -m'
+// merge splits, go in a normal QHash
+//
+class RevMap
+{
+    struct ObjectId
+    {
+        quint32 w[ 5 ];
+    };
+    QVector< quint32 > table;  // index in ids and revs plus 1, 0 if empty
+    QVector< ObjectId > ids;
+    QVector< const Rev* > revs;
+    QHash< ShaString, const Rev* > others;
+
+    static bool toId( const ShaString& sha, quint32* id );
+    int find( const quint32* id ) const;
+    void rehash( int size );
+
+public:
+    const Rev* value( const ShaString& sha ) const;
+    const Rev* operator[]( const ShaString& sha ) const { return value( sha ); }
+    bool contains( const ShaString& sha ) const { return value( sha ) != NULL; }
+    void insert( const ShaString& sha, const Rev* rev );
+    const Rev* take( const ShaString& sha );
+    void remove( const ShaString& sha ) { take( sha ); }
+    const QVector< const Rev* > values() const;
+    void clear();
+    int count() const { return revs.count() + others.count(); }
+    bool isEmpty() const { return count() == 0; }
 };
-typedef QHash< ShaString, const Rev* > RevMap;  // faster then a map
 
 //-----------------------------------------------------------------------------
 
 class RevFile
 {
     friend class Cache;  // to directly load status
+    friend class FilesCache;
     friend class Git;
 
     // Status information is splitted in a flags vector and in a string
@@ -445,8 +565,8 @@ public:
     //	defined outside RevFile. Paths are splitted in dir and file
     //	name, first all the dirs are listed then the file names to
     //	achieve a better compression when saved to disk.
-    //	A single QByteArray is used instead of two vectors because it's
-    //	much faster to load from disk when using a QDataStream
+    //	A single QByteArray is used instead of two vectors because it
+    //	has the same layout of the cache file records
     //
     QByteArray pathsIdx;
     QVector< int > mergeParent;
@@ -461,8 +581,6 @@ public:
     int count() const;
     bool statusCmp( int idx, StatusFlag sf ) const;
     const QString extendedStatus( int idx ) const;
-    const RevFile& operator>>( QDataStream& ) const;
-    RevFile& operator<<( QDataStream& );
 };
 typedef QHash< ShaString, const RevFile* > RevFileMap;
 
@@ -6,16 +6,29 @@
     Copyright: See COPYING file that comes with this distribution
 
 */
+#include <limits.h>
+#include <QAtomicInt>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QTemporaryFile>
+#include <QThread>
 
 #include "FileHistory.h"
 #include "dataloader.h"
 #include "git.h"
 
 #define GUI_UPDATE_INTERVAL 500
+#define FIRST_GUI_UPDATE_INTERVAL 20  // until the first revisions are shown
 #define READ_BLOCK_SIZE 65535
 
+//
+// Private (copy on write) mappings are needed because Rev::indexData()
+// writes '\0' terminators in place, they are available only since Qt 5.4
+//
+#if defined( USE_MMAP ) && ( QT_VERSION < 0x050400 || defined( USE_QPROCESS ) )
+#undef USE_MMAP
+#endif
+
 class UnbufferedTemporaryFile : public QTemporaryFile
 {
 public:
@@ -23,6 +36,344 @@ public:
     bool unbufOpen() { return open( QIODevice::ReadOnly | QIODevice::Unbuffered ); }
 };
 
+#define PARSER_POLL_INTERVAL 10
+
+#ifdef USE_MMAP
+
+#define PARSER_BATCH_SIZE 4096
+#define PARSER_RING_SIZE 256
+#define PARSER_MAP_SIZE ( 8 << 20 )  // pending bytes to map without waiting
+
+//
+// Lock-free ring buffer, safe only with exactly one producer
+// thread calling push() and one consumer thread calling pop()
+//
+template < class T, int N >
+class SpscRing
+{
+    T buf[ N ];
+    QAtomicInt head;  // next slot to read, written by consumer only
+    QAtomicInt tail;  // next slot to write, written by producer only
+
+public:
+    SpscRing() : head( 0 ), tail( 0 ) {}
+
+    bool push( const T& v )
+    {
+        int t = tail.load();
+        int next = ( t + 1 ) % N;
+        if( next == head.loadAcquire() )
+            return false;  // Full
+
+        buf[ t ] = v;
+        tail.storeRelease( next );
+        return true;
+    }
+
+    bool pop( T& v )
+    {
+        int h = head.load();
+        if( h == tail.loadAcquire() )
+            return false;  // Empty
+
+        v = buf[ h ];
+        head.storeRelease( ( h + 1 ) % N );
+        return true;
+    }
+};
+
+//
+// A run of consecutive parsed revisions. The mapped buffer they
+// index into is attached to the first batch that refers to it, a
+// NULL entry in 'revs' marks an early output "Final output" line
+//
+struct RevBatch
+{
+    explicit RevBatch( QByteArray* b ) : ba( b ), bytes( 0 ) {}
+    ~RevBatch()
+    {
+        arena.clear();
+        delete ba;
+    }
+    QByteArray* ba;
+    QVector< Rev* > revs;
+    RevArena arena;  // owns revs, handed over to FileHistory when spliced
+    ulong bytes;
+};
+
+//
+// Maps the growing 'git log' output file and builds Rev objects out
+// of the GUI thread. Only Rev::indexData(), the indexing of the sha line
+// and of the record end, runs here, that touches nothing but the record
+// bytes, the rest of the bookkeeping is done by Git::addRev() when
+// batches are spliced
+//
+class RevParser : public QThread
+{
+    const QString fileName;
+    QThread* const owner;  // thread that will use the mappings, see takeFile()
+    QFile* file;           // created, opened and mapped by this thread only
+    const bool withDiff;
+    qint64 parsedOfs;  // file offset of the first not yet parsed record
+    QElapsedTimer mapTime;  // since the last mapping with parsed records
+    QAtomicInt producerDone;
+    QAtomicInt stopped;
+    SpscRing< RevBatch*, PARSER_RING_SIZE > ring;
+
+    int parseBuffer( RevBatch** b );
+    bool parseNewData( bool last );
+    void publish( RevBatch* b );
+
+protected:
+    virtual void run();
+
+public:
+    RevParser( const QString& fn, bool wd )
+        : fileName( fn ), owner( QThread::currentThread() ), file( NULL ), withDiff( wd ),
+          parsedOfs( 0 ), producerDone( 0 ), stopped( 0 )
+    {
+    }
+    ~RevParser();
+
+    void finish() { producerDone.storeRelease( 1 ); }
+    void cancel();
+    RevBatch* takeBatch();
+    QFile* takeFile();
+};
+
+RevParser::~RevParser()
+{
+    cancel();
+
+    RevBatch* b;
+    while( ring.pop( b ) )
+        delete b;
+
+    delete file;  // Not taken, no spliced revision refers to it
+}
+
+QFile*
+RevParser::takeFile()
+{
+    //
+    // Only once the thread has exited, the file and its
+    // mappings belong to the caller from now on
+    //
+    if( !isFinished() )
+    {
+        dbs( "ASSERT in RevParser::takeFile, parser still running" );
+        return NULL;
+    }
+    QFile* f = file;
+    file = NULL;
+    return f;
+}
+
+void
+RevParser::cancel()
+{
+    stopped.storeRelease( 1 );
+    wait();
+}
+
+RevBatch*
+RevParser::takeBatch()
+{
+    RevBatch* b;
+    return ( ring.pop( b ) ? b : NULL );
+}
+
+void
+RevParser::run()
+{
+    mapTime.start();
+    while( !stopped.loadAcquire() )
+    {
+        //
+        // Read the flag before parsing, when set the
+        // producer has exited and the file is complete
+        //
+        bool last = producerDone.loadAcquire();
+
+        bool gotData = parseNewData( last );
+        if( last )
+            break;
+
+        if( !gotData )
+            msleep( PARSER_POLL_INTERVAL );
+    }
+    if( file )
+        file->moveToThread( owner );  // Deleted by FileHistory::clear()
+}
+
+void
+RevParser::publish( RevBatch* b )
+{
+    if( !b->ba && b->revs.isEmpty() )
+    {
+        delete b;
+        return;
+    }
+    while( !ring.push( b ) )
+    {
+        if( stopped.loadAcquire() )
+        {
+            delete b;  // Not seen by anybody
+            return;
+        }
+        msleep( 1 );  // GUI thread is behind
+    }
+}
+
+int
+RevParser::parseBuffer( RevBatch** bPtr )
+{
+    //
+    // Return the offset after the last complete record, or
+    // 0 if not even one record could be parsed
+    //
+    const QByteArray& ba = *( *bPtr )->ba;
+    int ofs = 0, parsedEnd = 0, bz = ba.size();
+
+    //
+    // Same bogus first byte workaround of parseSingleBuffer(),
+    // a buffer always starts at the beginning of a record
+    //
+    if( bz > 1 && ba.at( 0 ) == 0 )
+        ofs++;
+
+    while( bz - ofs > 0 && !stopped.loadAcquire() )
+    {
+        int next;
+        Rev* rev = ( *bPtr )->arena.newRev( ba, ofs, 0, &next, withDiff );
+
+        if( next == -2 )
+        {
+            ( *bPtr )->arena.release( rev );
+            ( *bPtr )->revs.append( NULL );
+            ofs = ba.indexOf( '\n', ofs ) + 1;
+            next = ofs;
+        }
+        else if( next == -1 )
+        {
+            //
+            // Incomplete record, will be parsed again next time
+            //
+            ( *bPtr )->arena.release( rev );
+            break;
+        }
+        else
+            ( *bPtr )->revs.append( rev );
+
+        ( *bPtr )->bytes += next - parsedEnd;
+        ofs = parsedEnd = next;
+
+        if( ( *bPtr )->revs.count() >= PARSER_BATCH_SIZE )
+        {
+            //
+            // Buffer is already owned by the published batch
+            //
+            publish( *bPtr );
+            *bPtr = new RevBatch( NULL );
+        }
+    }
+    return parsedEnd;
+}
+
+bool
+RevParser::parseNewData( bool last )
+{
+    if( !file )
+    {
+        if( !QFile::exists( fileName ) )
+            return false;
+
+        file = new QFile( fileName );  // No parent, owned by this thread
+    }
+    if( !file->isOpen() && !file->open( QIODevice::ReadOnly | QIODevice::Unbuffered ) )
+        return false;
+
+    //
+    // Map everything still to be parsed, from the beginning of the first
+    // incomplete record up to the current end of file. A record split at
+    // the end of the mapped region is left alone and mapped again as a
+    // whole next time, so no half chunk reassembly is needed. Mapped
+    // regions are not copied, the only memory used is for the pages
+    // where Rev::indexData() writes its '\0' terminators.
+    // A mapping must live as long as the revisions indexing into it, so
+    // after the first records new data is not mapped at each poll but
+    // only when GUI is going to splice it or when a lot of it is pending,
+    // this bounds the number of mappings kept. A mapping with no complete
+    // record is dropped at once, its data is mapped again next time.
+    // A single mapping is at most PARSER_MAP_SIZE long, as QByteArray
+    // size is an int, pending data is mapped in as many steps as needed.
+    // Only a record longer than that is mapped in a bigger region
+    //
+    qint64 fileSize = file->size();
+    qint64 mapSize = PARSER_MAP_SIZE;
+    bool gotData = false;
+    bool mapNow = ( last || parsedOfs == 0 || fileSize - parsedOfs >= PARSER_MAP_SIZE ||
+                    mapTime.elapsed() >= GUI_UPDATE_INTERVAL );
+
+    while( mapNow && fileSize - parsedOfs > 0 && !stopped.loadAcquire() )
+    {
+        qint64 len = qMin( fileSize - parsedOfs, mapSize );
+        bool isTail = ( len == fileSize - parsedOfs );
+
+        uchar* p = file->map( parsedOfs, len, QFileDevice::MapPrivateOption );
+        if( !p )
+        {
+            dbs( "ASSERT in RevParser::parseNewData, unable to map 'git log' output" );
+            return false;
+        }
+        QByteArray* ba = new QByteArray( QByteArray::fromRawData( ( const char* )p, int( len ) ) );
+        RevBatch* b = new RevBatch( ba );
+        int ofs = parseBuffer( &b );
+        if( ofs > 0 )
+        {
+            parsedOfs += ofs;
+            gotData = true;
+            mapTime.start();
+            publish( b );
+            mapSize = PARSER_MAP_SIZE;
+        }
+        else
+        {
+            //
+            // Not even one complete record, nobody refers to this mapping
+            //
+            delete b;
+            file->unmap( p );
+
+            if( isTail || mapSize >= INT_MAX )
+                break;
+
+            mapSize = qMin( mapSize * 2, qint64( INT_MAX ) );  // Record longer than mapSize
+        }
+        if( isTail )
+            break;
+    }
+
+    if( last && parsedOfs < fileSize && !stopped.loadAcquire() )
+    {
+        //
+        // Last record is not '\0' terminated, so copy it out
+        // of the file and append the missing terminator
+        //
+        file->seek( parsedOfs );
+        QByteArray* ba = new QByteArray( file->read( fileSize - parsedOfs ) );
+        parsedOfs += ba->size();
+        ba->append( '\0' );
+        RevBatch* b = new RevBatch( ba );
+        parseBuffer( &b );
+        publish( b );
+        gotData = true;
+    }
+    return gotData;
+}
+
+#endif  // USE_MMAP
+
 DataLoader::DataLoader( Git* g, FileHistory* f ) : QProcess( g ), git( g ), fh( f )
 {
     canceling = parsing = false;
@@ -30,6 +381,7 @@ DataLoader::DataLoader( Git* g, FileHistory* f ) : QProcess( g ), git( g ), fh(
     halfChunk = NULL;
     dataFile = NULL;
     loadedBytes = 0;
+    parser = NULL;
     guiUpdateTimer.setSingleShot( true );
 
     connect( git, SIGNAL( cancelAllProcesses() ), this, SLOT( on_cancel() ) );
@@ -42,6 +394,11 @@ DataLoader::~DataLoader()
     // Avoid a Qt warning in case we are destroyed while still running
     //
     waitForFinished( 1000 );
+
+#ifdef USE_MMAP
+    if( parser )
+        releaseParser();
+#endif
 }
 
 void
@@ -61,6 +418,15 @@ DataLoader::on_cancel()
         //
         canceling = true;
         kill();  // SIGKILL (Unix and Mac), TerminateProcess (Windows)
+
+#ifdef USE_MMAP
+        //
+        // Synchronously, the file could be deleted right after
+        // us by FileHistory::clear()
+        //
+        if( parser )
+            releaseParser();
+#endif
     }
 }
 
@@ -84,8 +450,13 @@ DataLoader::start( SCList args, SCRef wd, SCRef buf )
         return false;
     }
 
+#ifdef USE_MMAP
+    parser = new RevParser( dataFile->fileName(), !git->isMainHistory( fh ) );
+    connect( parser, SIGNAL( finished() ), this, SLOT( on_parserFinished() ) );
+    parser->start();
+#endif
     loadTime.start();
-    guiUpdateTimer.start( GUI_UPDATE_INTERVAL );
+    guiUpdateTimer.start( FIRST_GUI_UPDATE_INTERVAL );
     return true;
 }
 
@@ -107,6 +478,17 @@ DataLoader::on_finished( int, QProcess::ExitStatus )
         guiUpdateTimer.start( 1 );
 }
 
+void
+DataLoader::on_parserFinished()
+{
+    //
+    // Queued from the parser thread, the tail has been parsed. Parser
+    // could have been already released, then this is a no-op
+    //
+    if( guiUpdateTimer.isActive() )
+        guiUpdateTimer.start( 1 );
+}
+
 void
 DataLoader::on_timeout()
 {
@@ -131,6 +513,18 @@ DataLoader::on_timeout()
     //
     emit newDataReady( fh );
 
+#ifdef USE_MMAP
+    if( lastBuffer && parser )
+    {
+        //
+        // Parser is still on the tail, keep on draining it
+        // until on_parserFinished() wakes us up
+        //
+        guiUpdateTimer.start( GUI_UPDATE_INTERVAL );
+        parsing = false;
+        return;
+    }
+#endif
     if( lastBuffer )
     {
         emit loaded( fh, loadedBytes, loadTime.elapsed(), true, "", "" );
@@ -145,7 +539,7 @@ DataLoader::on_timeout()
         guiUpdateTimer.start( 1 );
     }
     else
-        guiUpdateTimer.start( GUI_UPDATE_INTERVAL );
+        guiUpdateTimer.start( loadedBytes ? GUI_UPDATE_INTERVAL : FIRST_GUI_UPDATE_INTERVAL );
 
     parsing = false;
 }
@@ -292,6 +686,83 @@ DataLoader::createTemporaryFile()
 
 #else  // Temporary file as data exchange facility
 
+#ifdef USE_MMAP
+
+ulong
+DataLoader::readNewData( bool lastBuffer )
+{
+    //
+    // Parsing is done by RevParser in its own thread, here we
+    // only splice already parsed batches into the history
+    //
+    if( !parser )
+        return 0;
+
+    if( lastBuffer )
+        parser->finish();
+
+    //
+    // Read the flag before draining, so that nothing published
+    // by the parser before exiting can be missed
+    //
+    bool parserExited = parser->isFinished();
+
+    ulong cnt = 0;
+    RevBatch* b;
+    while( ( b = parser->takeBatch() ) != NULL )
+    {
+        if( b->ba )
+            fh->rowData.append( b->ba );
+
+        fh->arena.take( b->arena );
+
+        FOREACH( QVector< Rev* >, it, b->revs )
+        {
+            if( *it )
+                git->addRev( fh, *it );
+            else
+                fh->setEarlyOutputState( true );  // "Final output" marker
+        }
+        cnt += b->bytes;
+        b->ba = NULL;
+        b->revs.clear();
+        delete b;
+    }
+    //
+    // When producer has exited but the parser has still to catch up
+    // with the tail we return anyway, on_timeout() is called again as
+    // soon as the parser exits, see on_parserFinished()
+    //
+    if( lastBuffer && parserExited )
+        releaseParser();
+
+    return cnt;
+}
+
+void
+DataLoader::releaseParser()
+{
+    //
+    // Stop the parser, then hand the file it mapped to the FileHistory,
+    // as mappings must live as long as the revisions that index into
+    // them. The temporary file follows, so clear() unmaps first and
+    // then removes the file. Batches not yet spliced are freed
+    //
+    parser->cancel();
+    QFile* f = parser->takeFile();
+    if( f )
+        fh->mappedFiles.append( f );
+
+    dataFile->setParent( fh );
+    fh->mappedFiles.append( dataFile );
+    dataFile = NULL;
+
+    delete parser;
+    parser = NULL;
+}
+
+#else
+
 ulong
 DataLoader::readNewData( bool lastBuffer )
 {
@@ -353,6 +824,8 @@ DataLoader::readNewData( bool lastBuffer )
     return cnt;
 }
 
+#endif  // USE_MMAP
+
 bool
 DataLoader::createTemporaryFile()
 {
@@ -409,3 +882,511 @@ DataLoader::createTemporaryFile()
 }
 
 #endif  // USE_QPROCESS
+
+// ****************************************************************************
+
+LongLogLoader::LongLogLoader( Git* g, const FileHistory* f, int first, int last, const Rev* r,
+                              const QVector< const Rev* >& revs )
+    : QObject( g ), fh( f ), todo( revs ), firstRow( first ), lastRow( last ), rev( r ),
+      done( 0 ), failed( false ), finished( false )
+{
+}
+
+bool
+LongLogLoader::isPending( const Rev* r, const FileHistory* f ) const
+{
+    //
+    // Rows out of range, as the ones added after loading
+    // started, are not pending, they are read on demand
+    //
+    if( f != fh || failed || r->isDiffCache || r->hasLongLog() || fh->longLogs.contains( r ) )
+        return false;
+
+    return ( r == rev || ( r->orderIdx >= firstRow && r->orderIdx <= lastRow ) );
+}
+
+void
+LongLogLoader::procReadyRead( const QByteArray& data )
+{
+    if( failed )
+        return;
+
+    pending.append( data );
+    const char* start = pending.constData();
+    const char* ptr = start;
+    failed = !Git::parseLongLogs( fh, todo, done, ptr, start + pending.size(), false );
+    pending.remove( 0, ptr - start );
+}
+
+void
+LongLogLoader::procFinished()
+{
+    if( !failed )
+    {
+        const char* ptr = pending.constData();
+        Git::parseLongLogs( fh, todo, done, ptr, ptr + pending.size(), true );
+    }
+    for( ; done < todo.count(); done++ )  // do not try again
+        fh->longLogs.insert( todo[ done ], QString() );
+
+    pending.clear();
+    finished = true;
+    emit loaded();
+}
+
+// ****************************************************************************
+
+DiffTreeLoader::DiffTreeLoader( Git* g )
+    : QThread( g ), git( g ), producerDone( 0 ), parserDone( 0 ), stopped( 0 ), parsedCnt( 0 )
+{
+}
+
+DiffTreeLoader::~DiffTreeLoader()
+{
+    stopped.storeRelease( 1 );
+    wait();
+    qDeleteAll( batches );
+}
+
+void
+DiffTreeLoader::procReadyRead( const QByteArray& data )
+{
+    QMutexLocker lock( &mutex );
+    incoming.append( data );
+}
+
+void
+DiffTreeLoader::procFinished()
+{
+    producerDone.storeRelease( 1 );
+}
+
+FileNamesBatch*
+DiffTreeLoader::takeBatch()
+{
+    QMutexLocker lock( &mutex );
+    return ( batches.isEmpty() ? NULL : batches.takeFirst() );
+}
+
+void
+DiffTreeLoader::run()
+{
+    //
+    // Git parsing helpers touch nothing but the
+    // loader passed in, that here is a local one
+    //
+    Git::FileNamesLoader fl( true );
+    QByteArray pending;
+    RevFile* rf = NULL;  // Last RevFile, more lines could still come
+    QString rfSha;
+    int dirsSent = 0, filesSent = 0;
+
+    while( !stopped.loadAcquire() )
+    {
+        //
+        // Read the flag before taking new data, when set
+        // the process has exited and nothing more will come
+        //
+        bool last = producerDone.loadAcquire();
+
+        mutex.lock();
+        bool gotData = !incoming.isEmpty();
+        pending.append( incoming );
+        incoming.clear();
+        mutex.unlock();
+
+        if( !gotData && !last )
+        {
+            msleep( PARSER_POLL_INTERVAL );
+            continue;
+        }
+        //
+        // Scan raw bytes, names are decoded only when first seen
+        //
+        FileNamesBatch* b = new FileNamesBatch;
+        const char* data = pending.constData();
+        const char* end = data + pending.size();
+        const char* pos = data;
+        const char* eol;
+        while( ( eol = ( const char* )memchr( pos, '\n', end - pos ) ) != NULL )
+        {
+            int len = ( int )( eol - pos );
+            if( *pos == ':' )
+            {
+                if( rf )
+                    git->parseDiffFormatLine( *rf, pos, len, 1, fl );
+            }
+            else if( len >= 40 )
+            {
+                //
+                // New commit, previous one is complete now
+                //
+                if( rf )
+                {
+                    git->flushFileNames( fl );
+                    b->shas.append( rfSha );
+                    b->files.append( rf );
+                }
+                rf = new RevFile();
+                rfSha = QString::fromLatin1( pos, 40 );
+            }
+            pos = eol + 1;
+        }
+        pending.remove( 0, pos - data );
+
+        if( last && rf )
+        {
+            git->flushFileNames( fl );
+            b->shas.append( rfSha );
+            b->files.append( rf );
+            rf = NULL;
+        }
+        if( !b->files.isEmpty() )
+        {
+            b->newDirs = fl.dirNamesVec.mid( dirsSent );
+            b->newFiles = fl.fileNamesVec.mid( filesSent );
+            dirsSent = fl.dirNamesVec.count();
+            filesSent = fl.fileNamesVec.count();
+
+            mutex.lock();
+            batches.append( b );
+            mutex.unlock();
+            parsedCnt.fetchAndAddRelease( b->files.count() );
+            emit newFileNames();
+        }
+        else
+            delete b;
+
+        if( last )
+        {
+            parserDone.storeRelease( 1 );
+            emit newFileNames();
+            return;
+        }
+    }
+    delete rf;  // Stopped while parsing
+}
+
+// ****************************************************************************
+
+TreeIndexer::TreeIndexer( Git* g, const FileHistory* fh, const QVector< uint >& types,
+                          bool down )
+    : QThread( g ), parentsOfs( fh->parentsOfs ), parentRows( fh->parentRows ),
+      childrenOfs( fh->childrenOfs ), childRows( fh->childRows ), refTypes( types ),
+      goDown( down ), stopped( 0 ), done( 0 )
+{
+}
+
+TreeIndexer::~TreeIndexer()
+{
+    stopped.storeRelease( 1 );
+    wait();
+}
+
+void
+TreeIndexer::publish( FileHistory* fh )
+{
+    fh->descRefsMaster.swap( descRefsMaster );
+    fh->ancRefsMaster.swap( ancRefsMaster );
+    fh->descRefs.swap( descRefs );
+    fh->ancRefs.swap( ancRefs );
+    fh->descBrnSet.swap( descBrnSet );
+    fh->brnSets.swap( brnSets );
+    fh->branchRows.swap( branchRows );
+}
+
+//
+// Reachability among tagged revisions, filled by TreeIndexer while
+// walking from newest to oldest, so that a tag is always added after
+// all its descendants. Tags are ranked in walk order and each rank
+// stores the lowest rank among its descendants, so descendants of
+// a tag are all in [low, rank). The range check settles most queries,
+// when ranges overlap because of merged branches a walk limited to
+// the tags whose range still contains the target is done instead
+//
+struct TagReach
+{
+    TagReach() : stamp( 0 ) {}
+    void add( int row, const QVector< int >& nearDesc );
+    bool isAncestor( int anc, int desc ) const;
+
+    QHash< int, int > rankOf;  // tag row -> rank
+    QVector< int > low;        // by rank
+    QVector< int > descOfs;    // by rank, offsets into descRanks
+    QVector< int > descRanks;  // ranks of nearest descendant tags
+    mutable QVector< int > visited;
+    mutable int stamp;
+};
+
+void
+TagReach::add( int row, const QVector< int >& nearDesc )
+{
+    int rank = low.count();
+    int l = rank;
+
+    if( descOfs.isEmpty() )
+        descOfs.append( 0 );
+
+    for( int i = 0; i < nearDesc.count(); i++ )
+    {
+        QHash< int, int >::const_iterator it( rankOf.constFind( nearDesc[ i ] ) );
+        if( it == rankOf.constEnd() )
+        {
+            dbp( "ASSERT descendant tag %1 not found", nearDesc[ i ] );
+            continue;
+        }
+        descRanks.append( *it );
+        l = qMin( l, low[ *it ] );
+    }
+    rankOf.insert( row, rank );
+    low.append( l );
+    descOfs.append( descRanks.count() );
+    visited.append( 0 );
+}
+
+bool
+TagReach::isAncestor( int anc, int desc ) const
+{
+    QHash< int, int >::const_iterator ia( rankOf.constFind( anc ) );
+    QHash< int, int >::const_iterator id( rankOf.constFind( desc ) );
+    if( ia == rankOf.constEnd() || id == rankOf.constEnd() )
+        return false;
+
+    int ra = *ia, rd = *id;
+    if( rd >= ra || rd < low[ ra ] )
+        return false;
+
+    //
+    // Ranges overlap, walk the nearest descendants skipping
+    // any tag already visited or whose range misses target
+    //
+    stamp++;
+    QVector< int > stack( 1, ra );
+    while( !stack.isEmpty() )
+    {
+        int r = stack.last();
+        stack.removeLast();
+
+        for( int y = descOfs[ r ]; y < descOfs[ r + 1 ]; y++ )
+        {
+            int c = descRanks[ y ];
+            if( c == rd )
+                return true;
+
+            if( visited[ c ] != stamp && rd < c && rd >= low[ c ] )
+            {
+                visited[ c ] = stamp;
+                stack.append( c );
+            }
+        }
+    }
+    return false;
+}
+
+static uint
+wordsHash( const QVector< uint >& words )
+{
+    uint h = words.count();
+    for( int i = 0; i < words.count(); i++ )
+        h = h * 31 + words[ i ];
+
+    return h;
+}
+
+int
+TreeIndexer::internBranchSet( const QVector< uint >& words )
+{
+    //
+    // Sets of descendant branches are the same for long runs of rows
+    // and are repeated many times across merges, store each only once
+    //
+    uint h = wordsHash( words );
+    QMultiHash< uint, int >::const_iterator it( brnSetIds.constFind( h ) );
+    for( ; it != brnSetIds.constEnd() && it.key() == h; ++it )
+        if( brnSets[ *it ] == words )
+            return *it;
+
+    int id = brnSets.count();
+    brnSets.append( words );
+    brnSetIds.insert( h, id );
+    return id;
+}
+
+int
+TreeIndexer::addBranch( int set, int bit )
+{
+    QVector< uint > words;
+    if( set != -1 )
+        words = brnSets[ set ];
+
+    while( words.count() <= bit / 32 )
+        words.append( 0 );
+
+    words[ bit / 32 ] |= 1U << ( bit % 32 );
+    return internBranchSet( words );
+}
+
+int
+TreeIndexer::mergeBranches( int set1, int set2 )
+{
+    if( set1 == set2 || set2 == -1 )
+        return set1;
+
+    if( set1 == -1 )
+        return set2;
+
+    //
+    // We want all the descendant branches, a word wise OR of the
+    // two sets. The same pair is merged again in many places
+    //
+    quint64 key = ( ( quint64 )qMin( set1, set2 ) << 32 ) | ( uint )qMax( set1, set2 );
+    QHash< quint64, int >::const_iterator it( brnUnions.constFind( key ) );
+    if( it != brnUnions.constEnd() )
+        return *it;
+
+    const QVector< uint >& s1 = brnSets[ set1 ];
+    const QVector< uint >& s2 = brnSets[ set2 ];
+    QVector< uint > words( s1.count() >= s2.count() ? s1 : s2 );
+    const QVector< uint >& other = ( s1.count() >= s2.count() ? s2 : s1 );
+    for( int i = 0; i < other.count(); i++ )
+        words[ i ] |= other[ i ];
+
+    int id = internBranchSet( words );
+    brnUnions.insert( key, id );
+    return id;
+}
+
+void
+TreeIndexer::mergeNearTags( bool down, int p, int r, bool isTag, const TagReach& tr )
+{
+    QVector< int >& masters = ( down ? descRefsMaster : ancRefsMaster );
+    QHash< int, QVector< int > >& nearRefs = ( down ? descRefs : ancRefs );
+    int& p_master = masters[ p ];
+    int r_master = ( isTag ? r : masters[ r ] );
+
+    if( p_master == r_master || r_master == -1 )
+        return;
+
+    //
+    // We want the nearest tag only, so remove any tag
+    // that is ancestor of any other tag in p U r
+    //
+    const QVector< int > src1( nearRefs.value( p_master ) );
+    const QVector< int > src2( nearRefs.value( r_master ) );
+    QVector< int > dst( src1 );
+    for( int s2 = 0; s2 < src2.count(); s2++ )
+    {
+        bool add = false;
+        for( int s1 = 0; s1 < src1.count(); s1++ )
+        {
+            if( src2[ s2 ] == src1[ s1 ] )
+            {
+                add = false;
+                break;
+            }
+            bool isAnc = tr.isAncestor( src2[ s2 ], src1[ s1 ] );
+
+            if( !isAnc && !tr.isAncestor( src1[ s1 ], src2[ s2 ] ) )
+            {
+                add = true;  // Could be an independent path
+                continue;
+            }
+            add = ( down && isAnc ) || ( !down && !isAnc );
+            if( add )
+                dst[ s1 ] = -1;  // Mark for removing
+            else
+                break;
+        }
+        if( add )
+            dst.append( src2[ s2 ] );
+    }
+    QVector< int >& pRefs = nearRefs[ p ];
+    pRefs.clear();
+    for( int s2 = 0; s2 < dst.count(); s2++ )
+        if( dst[ s2 ] != -1 )
+            pRefs.append( dst[ s2 ] );
+
+    p_master = p;
+}
+
+void
+TreeIndexer::run()
+{
+    //
+    // Only the snapshot taken in the constructor is used here, results
+    // are not visible until publish() is called from the GUI thread
+    //
+    int cnt = refTypes.count();
+    const QVector< int >& po = parentsOfs;
+    const QVector< int >& pr = parentRows;
+    const QVector< int >& co = childrenOfs;
+    const QVector< int >& cr = childRows;
+
+    descRefsMaster.fill( -1, cnt );
+    ancRefsMaster.fill( -1, cnt );
+    descBrnSet.fill( -1, cnt );
+    TagReach tagReach;
+
+    //
+    // Walk down the tree from latest to oldest,
+    // compute nearest descendants
+    //
+    for( int i = 0; i < cnt; i++ )
+    {
+        if( stopped.loadAcquire() )
+            return;
+
+        bool isB = ( refTypes[ i ] & ( Git::BRANCH | Git::RMT_BRANCH ) );
+        bool isT = ( refTypes[ i ] & Git::TAG );
+
+        if( isB )
+        {
+            descBrnSet[ i ] = addBranch( descBrnSet[ i ], branchRows.count() );
+            branchRows.append( i );
+        }
+        if( isT )
+        {
+            int m = descRefsMaster[ i ];
+            tagReach.add( i, m != -1 ? descRefs.value( m ) : QVector< int >() );
+            descRefs.insert( i, QVector< int >( 1, i ) );
+        }
+        for( int y = po[ i ]; y < po[ i + 1 ]; y++ )
+        {
+            int p = pr[ y ];
+            if( p == -1 )
+                continue;
+
+            descBrnSet[ p ] = mergeBranches( descBrnSet[ p ], descBrnSet[ i ] );
+
+            if( descRefsMaster[ p ] == -1 )
+                descRefsMaster[ p ] = isT ? i : descRefsMaster[ i ];
+            else
+                mergeNearTags( goDown, p, i, isT, tagReach );
+        }
+    }
+
+    //
+    // Walk backward through the tree and compute nearest tagged ancestors
+    //
+    for( int i = cnt - 1; i >= 0; i-- )
+    {
+        if( stopped.loadAcquire() )
+            return;
+
+        bool isTag = ( refTypes[ i ] & Git::TAG );
+
+        if( isTag )
+            ancRefs.insert( i, QVector< int >( 1, i ) );
+
+        for( int y = co[ i ]; y < co[ i + 1 ]; y++ )
+        {
+            int c = cr[ y ];
+            if( ancRefsMaster[ c ] == -1 )
+                ancRefsMaster[ c ] = isTag ? i : ancRefsMaster[ i ];
+            else
+                mergeNearTags( !goDown, c, i, isTag, tagReach );
+        }
+    }
+    done.storeRelease( 1 );
+    emit indexed();
+}
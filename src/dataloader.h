@@ -7,13 +7,20 @@
 #ifndef DATALOADER_H
 #define DATALOADER_H
 
+#include <QAtomicInt>
+#include <QMutex>
 #include <QProcess>
+#include <QThread>
 #include <QTime>
 #include <QTimer>
 
+#include "common.h"
+
 class Git;
 class FileHistory;
 class QString;
+class RevParser;
+struct TagReach;
 class UnbufferedTemporaryFile;
 
 //
@@ -22,6 +29,14 @@ class UnbufferedTemporaryFile;
 // #define USE_QPROCESS
 //
 
+//
+// With the temporary file facility 'git log' output is memory mapped and
+// parsed by a background thread, so that revisions index straight into the
+// mapping. Comment following line to read the file in 64KB blocks and parse
+// it in the GUI thread instead. Requires Qt 5.4 or later
+//
+#define USE_MMAP
+
 class DataLoader : public QProcess
 {
     Q_OBJECT
@@ -33,6 +48,7 @@ class DataLoader : public QProcess
     QTime loadTime;
     QTimer guiUpdateTimer;
     ulong loadedBytes;
+    RevParser* parser;
     bool isProcExited;
     bool parsing;
     bool canceling;
@@ -42,11 +58,13 @@ class DataLoader : public QProcess
     void addSplittedChunks( const QByteArray* halfChunk );
     bool createTemporaryFile();
     ulong readNewData( bool lastBuffer );
+    void releaseParser();
 
 private slots:
     void on_finished( int, QProcess::ExitStatus );
     void on_cancel();
     void on_cancel( const FileHistory* );
+    void on_parserFinished();
     void on_timeout();
 
 public:
@@ -60,4 +78,148 @@ signals:
     void loaded( FileHistory*, ulong, int, bool, const QString&, const QString& );
 };
 
+//
+// A run of consecutive RevFile parsed by a DiffTreeLoader, with the
+// names the loader interned for the first time while parsing them
+//
+struct FileNamesBatch
+{
+    ~FileNamesBatch() { qDeleteAll( files ); }
+    StrVect shas;
+    QVector< RevFile* > files;
+    StrVect newDirs;
+    StrVect newFiles;
+};
+
+//
+// Receives the output of one of the 'git diff-tree --stdin' processes
+// used to load file names, and parses it in its own thread straight
+// into RevFile structures. Names are interned in a local dictionary,
+// the GUI thread remaps them when batches are merged, in order, by
+// Git::on_fileNamesReady()
+//
+class DiffTreeLoader : public QThread
+{
+    Q_OBJECT
+
+    Git* git;
+    QMutex mutex;                      // protects incoming and batches
+    QByteArray incoming;               // output not yet seen by the parser
+    QList< FileNamesBatch* > batches;  // parsed, not yet merged
+    QAtomicInt producerDone;
+    QAtomicInt parserDone;
+    QAtomicInt stopped;
+    QAtomicInt parsedCnt;
+
+protected:
+    virtual void run();
+
+public slots:
+    void procReadyRead( const QByteArray& );
+    void procFinished();
+
+public:
+    explicit DiffTreeLoader( Git* g );
+    ~DiffTreeLoader();
+
+    bool isDone() const { return parserDone.loadAcquire(); }
+    int parsedCount() const { return parsedCnt.loadAcquire(); }
+    FileNamesBatch* takeBatch();
+
+    QVector< int > dirsRemap;  // used by Git::mergeFileNames() only
+    QVector< int > filesRemap;
+
+signals:
+    void newFileNames();
+};
+
+//
+// Receives the output of a 'git log' process started by
+// Git::loadLongLogs(), and stores the log messages of the
+// rows first to last, and of 'r', in FileHistory::longLogs
+// as complete records come in
+//
+class LongLogLoader : public QObject
+{
+    Q_OBJECT
+
+    const FileHistory* fh;
+    QVector< const Rev* > todo;  // in the same order of the output
+    int firstRow;
+    int lastRow;
+    const Rev* rev;              // read also if out of rows range
+    int done;
+    bool failed;
+    bool finished;               // all output received
+    QByteArray pending;          // last record, not complete yet
+
+public slots:
+    void procReadyRead( const QByteArray& );
+    void procFinished();
+
+public:
+    LongLogLoader( Git* g, const FileHistory* f, int first, int last, const Rev* r,
+                   const QVector< const Rev* >& revs );
+
+    bool isLoading( const FileHistory* f ) const { return ( f == fh ); }
+    bool isLoading( const FileHistory* f, int first, int last ) const
+    {
+        return ( f == fh && !failed && first >= firstRow && last <= lastRow );
+    }
+    bool isPending( const Rev* r, const FileHistory* f ) const;
+    bool isDone() const { return finished; }
+
+signals:
+    void loaded();
+};
+
+//
+// Computes the near tags and the descendant branches of each row of the
+// main view in its own thread, on a snapshot of the graph and of the
+// ref types taken by Git::indexTree(). Results are handed over to
+// FileHistory by publish(), from the GUI thread, once all done
+//
+class TreeIndexer : public QThread
+{
+    Q_OBJECT
+
+    QVector< int > parentsOfs;  // graph snapshot, see FileHistory
+    QVector< int > parentRows;
+    QVector< int > childrenOfs;
+    QVector< int > childRows;
+    QVector< uint > refTypes;   // Git::RefType flags of each row
+    bool goDown;
+    QAtomicInt stopped;
+    QAtomicInt done;
+
+    QVector< int > descRefsMaster;  // results, see FileHistory
+    QVector< int > ancRefsMaster;
+    QHash< int, QVector< int > > descRefs;
+    QHash< int, QVector< int > > ancRefs;
+    QVector< int > descBrnSet;
+    QVector< QVector< uint > > brnSets;
+    QVector< int > branchRows;
+
+    QMultiHash< uint, int > brnSetIds;  // hash of the words -> set id
+    QHash< quint64, int > brnUnions;    // pair of set ids -> id of their union
+
+    void mergeNearTags( bool down, int p, int r, bool isTag, const TagReach& tr );
+    int internBranchSet( const QVector< uint >& words );
+    int addBranch( int set, int bit );
+    int mergeBranches( int set1, int set2 );
+
+protected:
+    virtual void run();
+
+public:
+    TreeIndexer( Git* g, const FileHistory* fh, const QVector< uint >& types, bool down );
+    ~TreeIndexer();
+
+    bool isDone() const { return done.loadAcquire(); }
+    void publish( FileHistory* fh );
+
+signals:
+    void indexed();
+};
+
 #endif
@@ -7,6 +7,8 @@
 
 */
 #include <QApplication>
+#include <QBitArray>
+#include <QDataStream>
 #include <QDir>
 #include <QFile>
 #include <QImageReader>
@@ -16,6 +18,8 @@
 #include <QTextCodec>
 #include <QTextDocument>
 #include <QTextStream>
+#include <QThread>
+#include <QtEndian>
 
 #include "FileHistory.h"
 #include "annotate.h"
@@ -30,6 +34,10 @@
     QApplication::postEvent( parent(), new MessageEvent( x ) );                                    \
     EM_PROCESS_EVENTS_NO_INPUT;
 
+#define MAX_DIFF_TREE_PROCS 8    // concurrent 'git diff-tree' when loading file names
+#define MIN_DIFF_TREE_REVS 2000  // revisions below which a new process is not worth
+#define LONG_LOG_BATCH 256                   // log messages read together with the asked one
+
 //
 // Used on init() for reading parameters once;
 // It's OK to be unique among qgit windows.
@@ -68,7 +76,13 @@ Git::Git( QObject* p ) : QObject( p )
     errorReportingEnabled = true;  // report errors if run() fails
     curDomain = NULL;
     revData = NULL;
+    revCache = NULL;
+    loadingRevDelta = revCacheNeedsUpdate = false;
+    revCacheLanesEnd = -1;
+    diffTreeMerged = filesLoadedCnt = 0;
+    treeIndexer = NULL;
     revsFiles.reserve( MAX_DICT_SIZE );
+    filesCache = new FilesCache();
 
     //
     // NOTE: git default encoding is UTF-8
@@ -76,6 +90,14 @@ Git::Git( QObject* p ) : QObject( p )
     setTextCodec( QTextCodec::codecForName( "utf8" ) );
 }
 
+Git::~Git()
+{
+    clearDiffTreeLoaders();  // Before file names they merge into
+    clearTreeIndexer();
+    cancelLongLogs( revData );
+    delete filesCache;
+}
+
 void
 Git::checkEnvironment()
 {
@@ -597,10 +619,10 @@ Git::run( QByteArray* runOutput, SCRef runCmd, QObject* receiver, SCRef buf )
 }
 
 MyProcess*
-Git::runAsync( SCRef runCmd, QObject* receiver, SCRef buf )
+Git::runAsync( SCRef runCmd, QObject* receiver, SCRef buf, bool stdErr )
 {
     MyProcess* p = new MyProcess( parent(), this, workDir, errorReportingEnabled );
-    if( !p->runAsync( runCmd, receiver, buf ) )
+    if( !p->runAsync( runCmd, receiver, buf, stdErr ) )
     {
         delete p;
         p = NULL;
@@ -670,7 +692,7 @@ Git::getLaneParent( SCRef fromSHA, int laneNum )
 
     for( int idx = rs->orderIdx - 1; idx >= 0; idx-- )
     {
-        const Rev* r = revLookup( revData->revOrder[ idx ] );
+        const Rev* r = revData->revAt( idx );
         if( laneNum >= r->lanes.count() )
             return "";
 
@@ -695,11 +717,12 @@ Git::getChildren( SCRef parent )
 {
     QStringList children;
     const Rev* r = revLookup( parent );
-    if( !r )
+    const FileHistory* fh = revData;
+    if( !r || !fh->isTopologyIndexed() )
         return children;
 
-    for( int i = 0; i < r->children.count(); i++ )
-        children.append( revData->revOrder[ r->children[ i ] ] );
+    for( int i = fh->childrenOfs[ r->orderIdx ]; i < fh->childrenOfs[ r->orderIdx + 1 ]; i++ )
+        children.append( fh->revOrder[ fh->childRows[ i ] ] );
 
     //
     // Reorder children by loading order
@@ -1015,18 +1038,42 @@ Git::isSameFiles( SCRef tree1Sha, SCRef tree2Sha )
 }
 
 const QStringList
-Git::getDescendantBranches( SCRef sha, bool shaOnly )
+Git::getDescendantBranches( SCRef sha, bool shaOnly, bool* pending )
 {
+    //
+    // Until TreeIndexer has finished the list is empty and
+    // 'pending' is set, treeIndexed() is emitted once done.
+    // Shas only are walked on demand instead, not to wait
+    //
     QStringList tl;
+    if( pending )
+        *pending = false;
+
     const Rev* r = revLookup( sha );
-    if( !r || ( r->descBrnMaster == -1 ) )
+    if( !r )
         return tl;
 
-    const QVector< int >& nr = revLookup( revData->revOrder[ r->descBrnMaster ] )->descBranches;
+    if( treeIndexer && shaOnly )
+        return walkDescendantBranches( r );
 
-    for( int i = 0; i < nr.count(); i++ )
+    if( treeIndexer )
     {
-        const ShaString& sha = revData->revOrder[ nr[ i ] ];
+        if( pending )
+            *pending = true;
+        return tl;
+    }
+    const FileHistory* fh = revData;
+    if( r->orderIdx >= fh->descBrnSet.count() || fh->descBrnSet[ r->orderIdx ] == -1 )
+        return tl;
+
+    const QVector< uint >& words = fh->brnSets[ fh->descBrnSet[ r->orderIdx ] ];
+
+    for( int i = 0; i < words.count() * 32; i++ )
+    {
+        if( !( words[ i / 32 ] & ( 1U << ( i % 32 ) ) ) )
+            continue;
+
+        const ShaString& sha = revData->revOrder[ fh->branchRows[ i ] ];
         if( shaOnly )
         {
             tl.append( sha );
@@ -1047,19 +1094,71 @@ Git::getDescendantBranches( SCRef sha, bool shaOnly )
 }
 
 const QStringList
-Git::getNearTags( bool goDown, SCRef sha )
+Git::walkDescendantBranches( const Rev* r )
+{
+    //
+    // Branches reachable going up from r by the graph topology,
+    // as TreeIndexer would find them, r included, in row order
+    //
+    QStringList tl;
+    const FileHistory* fh = revData;
+    if( !fh->isTopologyIndexed() )
+        return tl;
+
+    QBitArray seen( fh->revOrder.count() );
+    QVector< int > todo( 1, r->orderIdx ), rows;
+    seen.setBit( r->orderIdx );
+    while( !todo.isEmpty() )
+    {
+        int row = todo.last();
+        todo.pop_back();
+        if( checkRef( fh->revOrder[ row ], BRANCH | RMT_BRANCH ) )
+            rows.append( row );
+
+        for( int y = fh->childrenOfs[ row ]; y < fh->childrenOfs[ row + 1 ]; y++ )
+        {
+            int c = fh->childRows[ y ];
+            if( !seen.testBit( c ) )
+            {
+                seen.setBit( c );
+                todo.append( c );
+            }
+        }
+    }
+    qSort( rows );
+    FOREACH( QVector< int >, it, rows )
+    tl.append( fh->revOrder[ *it ] );
+
+    return tl;
+}
+
+const QStringList
+Git::getNearTags( bool goDown, SCRef sha, bool* pending )
 {
     QStringList tl;
+    if( pending )
+        *pending = false;
+
     const Rev* r = revLookup( sha );
     if( !r )
         return tl;
 
-    int nearRefsMaster = ( goDown ? r->descRefsMaster : r->ancRefsMaster );
+    if( treeIndexer )
+    {
+        if( pending )
+            *pending = true;  // See getDescendantBranches()
+        return tl;
+    }
+
+    const FileHistory* fh = revData;
+    if( r->orderIdx >= fh->descRefsMaster.count() )
+        return tl;
+
+    int nearRefsMaster = ( goDown ? fh->descRefsMaster : fh->ancRefsMaster )[ r->orderIdx ];
     if( nearRefsMaster == -1 )
         return tl;
 
-    const QVector< int >& nr = goDown ? revLookup( revData->revOrder[ nearRefsMaster ] )->descRefs
-                                      : revLookup( revData->revOrder[ nearRefsMaster ] )->ancRefs;
+    const QVector< int > nr( ( goDown ? fh->descRefs : fh->ancRefs ).value( nearRefsMaster ) );
 
     for( int i = 0; i < nr.count(); i++ )
     {
@@ -1072,6 +1171,196 @@ Git::getNearTags( bool goDown, SCRef sha )
     return tl;
 }
 
+const QString
+Git::getLongLog( const Rev* r, const FileHistory* fh )
+{
+    //
+    // Main history is loaded without log message bodies, they are read
+    // in background when first asked for, together with the ones of the
+    // rows around, that are likely to be asked for next. Until read an
+    // empty message is returned, see isLongLogPending(), longLogsLoaded()
+    // is emitted once done
+    //
+    if( r->hasLongLog() || r->isDiffCache || !isMainHistory( fh ) )
+        return r->longLog();
+
+    if( !fh->longLogs.contains( r ) && !isLongLogPending( r, fh ) )
+    {
+        int first = r->orderIdx - LONG_LOG_BATCH / 2;
+        loadLongLogs( fh, first, first + LONG_LOG_BATCH, r );
+    }
+
+    return fh->longLogs.value( r );
+}
+
+void
+Git::longLogsTodo( const FileHistory* fh, int first, int last, const Rev* r,
+                   QVector< const Rev* >& todo, QString& buf )
+{
+    if( r && !r->isDiffCache && !r->hasLongLog() && !fh->longLogs.contains( r ) )
+    {
+        todo.append( r );
+        buf.append( r->sha() ).append( '\n' );
+    }
+    for( int i = first; i <= last; i++ )
+    {
+        const Rev* c = fh->revAt( i );
+        if( !c || c == r || c->isDiffCache || c->hasLongLog() || fh->longLogs.contains( c ) )
+            continue;
+
+        todo.append( c );
+        buf.append( c->sha() ).append( '\n' );
+    }
+}
+
+bool
+Git::parseLongLogs( const FileHistory* fh, const QVector< const Rev* >& todo, int& done,
+                    const char*& data, const char* end, bool last )
+{
+    //
+    // Output is in the same order of the input, each record is the
+    // sha followed by the message body. Records are '\0' separated,
+    // the one at the end is complete only when there is no more data
+    //
+    while( done < todo.count() && end - data > 40 )
+    {
+        const Rev* r = todo[ done ];
+        if( memcmp( data, r->sha().latin1(), 40 ) != 0 )
+        {
+            dbp( "ASSERT in parseLongLogs, unexpected log of %1", r->sha() );
+            return false;
+        }
+        const char* recEnd = ( const char* )memchr( data, 0, end - data );
+        if( !recEnd && !last )
+            break;
+
+        if( !recEnd )
+            recEnd = end;
+
+        //
+        // Same as Rev::longLog(), heading '\n' included, empty if no body
+        //
+        const char* body = data + 41;
+        QString longLog;
+        if( body < recEnd )
+            longLog = Rev::decode( body - 1, recEnd - body + 1 );
+
+        fh->longLogs.insert( r, longLog );
+        data = ( recEnd < end ? recEnd + 1 : end );
+        done++;
+    }
+    return true;
+}
+
+bool
+Git::loadLongLogs( const FileHistory* fh, int first, int last, const Rev* r )
+{
+    //
+    // Rows are indexed by revOrder, that is ahead of rowCount()
+    // while loading, 'r' is always read, also if not in range
+    //
+    first = qMax( first, 0 );
+    last = qMin( last, fh->revOrder.count() - 1 );
+
+    QVector< const Rev* > todo;
+    QString buf;
+    longLogsTodo( fh, first, last, r, todo, buf );
+    if( todo.isEmpty() )
+        return false;
+
+    LongLogLoader* ll = new LongLogLoader( this, fh, first, last, r, todo );
+    connect( ll, SIGNAL( loaded() ), this, SLOT( on_longLogsLoaded() ) );
+
+    const QString runCmd( "git log --no-walk=unsorted --no-color -z --stdin --format=%H%n%b" );
+    MyProcess* p = runAsync( runCmd, ll, buf, false );  // Records are parsed, stdout only
+    if( !p )
+    {
+        dbs( "ASSERT in loadLongLogs, unable to read log messages" );
+        delete ll;
+        FOREACH( QVector< const Rev* >, it, todo )
+        fh->longLogs.insert( *it, QString() );  // do not try again
+
+        return false;
+    }
+    longLogLoaders.append( ll );
+    longLogProcs.append( p );
+    return true;
+}
+
+bool
+Git::prefetchLongLogs( const FileHistory* fh )
+{
+    //
+    // Read in background the log messages of all the rows, as
+    // filtering on them needs. Until done, getLongLog() is not
+    // called for the rows pending, see isLongLogPending(), and
+    // longLogsLoaded() is emitted at the end to filter again
+    //
+    if( !isMainHistory( fh ) )
+        return false;
+
+    int last = fh->revOrder.count() - 1;
+    FOREACH( QVector< LongLogLoader* >, it, longLogLoaders )
+    {
+        if( ( *it )->isLoading( fh, 0, last ) )
+            return true;
+    }
+    return loadLongLogs( fh, 0, last, NULL );
+}
+
+bool
+Git::isLongLogPending( const Rev* r, const FileHistory* fh ) const
+{
+    FOREACH( QVector< LongLogLoader* >, it, longLogLoaders )
+    {
+        if( ( *it )->isPending( r, fh ) )
+            return true;
+    }
+    return false;
+}
+
+void
+Git::cancelLongLogs( const FileHistory* fh )
+{
+    //
+    // Called also when rows are released, the loaders
+    // and the processes feeding them are gone on return
+    //
+    for( int i = longLogLoaders.count() - 1; i >= 0; i-- )
+    {
+        if( !longLogLoaders.at( i )->isLoading( fh ) )
+            continue;
+
+        MyProcess* p = longLogProcs.at( i );
+        if( p && p->state() != QProcess::NotRunning )
+            p->on_cancel();
+
+        delete longLogLoaders.at( i );
+        longLogLoaders.remove( i );
+        longLogProcs.remove( i );
+    }
+}
+
+void
+Git::on_longLogsLoaded()
+{
+    //
+    // Finished loaders are removed, their processes are
+    // already auto-deleted. Signal from a canceled loader
+    // cannot come, it has been deleted
+    //
+    for( int i = longLogLoaders.count() - 1; i >= 0; i-- )
+    {
+        if( !longLogLoaders.at( i )->isDone() )
+            continue;
+
+        longLogLoaders.at( i )->deleteLater();  // We could be called by it
+        longLogLoaders.remove( i );
+        longLogProcs.remove( i );
+    }
+    emit longLogsLoaded();
+}
+
 const QString
 Git::getLastCommitMsg()
 {
@@ -1097,7 +1386,15 @@ Git::getLastCommitMsg()
         return "";
     }
 
-    return c->shortLog() + "\n\n" + c->longLog().trimmed();
+    //
+    // Message is to be amended, so it is read now if not loaded yet
+    //
+    QString longLog( getLongLog( c, revData ) );
+    if( isLongLogPending( c, revData ) &&
+        !run( "git log --no-walk --no-color --format=%b " + sha, &longLog ) )
+        dbp( "ASSERT: getLastCommitMsg unable to read message of <%1>", sha );
+
+    return c->shortLog() + "\n\n" + longLog.trimmed();
 }
 
 const QString
@@ -1155,6 +1452,12 @@ Git::formatList( SCList sl, SCRef name, bool inOneLine )
     return ls;
 }
 
+const QString
+Git::formatPending( SCRef name )
+{
+    return "<tr><td class='h'>" + name + "</td><td><i>computing...</i></td></tr>\n";
+}
+
 const QString
 Git::getDesc( SCRef sha, QRegExp& shortLogRE, QRegExp& longLogRE, bool showHeader, FileHistory* fh )
 {
@@ -1215,12 +1518,25 @@ Git::getDesc( SCRef sha, QRegExp& shortLogRE, QRegExp& longLogRE, bool showHeade
             {
                 ts << formatList( c->parents(), "Parent", false );
                 ts << formatList( getChildren( sha ), "Child", false );
-                ts << formatList( getDescendantBranches( sha ), "Branch", false );
-                ts << formatList( getNearTags( !optGoDown, sha ), "Follows" );
-                ts << formatList( getNearTags( optGoDown, sha ), "Precedes" );
+                //
+                // Near refs could be still computed, this
+                // is shown again when treeIndexed() is emitted
+                //
+                bool pending;
+                const QStringList brn( getDescendantBranches( sha, false, &pending ) );
+                ts << ( pending ? formatPending( "Branch" ) : formatList( brn, "Branch", false ) );
+
+                const QStringList fol( getNearTags( !optGoDown, sha, &pending ) );
+                ts << ( pending ? formatPending( "Follows" ) : formatList( fol, "Follows" ) );
+
+                const QStringList pre( getNearTags( optGoDown, sha, &pending ) );
+                ts << ( pending ? formatPending( "Precedes" ) : formatList( pre, "Precedes" ) );
             }
         }
-        QString longLog( c->longLog() );
+        QString longLog( getLongLog( c, fh ? fh : revData ) );
+        if( isLongLogPending( c, fh ? fh : revData ) )
+            longLog = "\n(reading log message...)";  // Updated once read
+
         if( showHeader )
         {
             longLog.prepend( QString( "\n" ) + c->shortLog() + "\n" );
@@ -1355,8 +1671,9 @@ Git::getFiles( SCRef sha, SCRef diffToSha, bool allFiles, SCRef path )
         //
         return insertNewFiles( CUSTOM_SHA, runOutput );
     }
-    if( revsFiles.contains( r->sha() ) )
-        return revsFiles[ r->sha() ];  // ZERO_SHA search arrives here
+    const RevFile* rf = revFileLookup( r->sha() );
+    if( rf )
+        return rf;  // ZERO_SHA search arrives here
 
     if( sha == ZERO_SHA )
     {
@@ -1370,8 +1687,9 @@ Git::getFiles( SCRef sha, SCRef diffToSha, bool allFiles, SCRef path )
     if( !runDiffTreeWithRenameDetection( runCmd, &runOutput ) )
         return NULL;
 
-    if( revsFiles.contains( r->sha() ) )  // Has been created in the mean time?
-        return revsFiles[ r->sha() ];
+    rf = revFileLookup( r->sha() );
+    if( rf )  // Has been created in the mean time?
+        return rf;
 
     cacheNeedsUpdate = true;
     return insertNewFiles( sha, runOutput );
@@ -1431,24 +1749,59 @@ Git::getNewestFileName( SCList branches, SCRef fileName )
     return curFileName;
 }
 
+static bool
+matchPath( const QRegExp& rx, const StrVect& dirs, const StrVect& files, int dir, int name,
+           QHash< quint64, bool >& matched )
+{
+    //
+    // Same paths show up in many revisions, match each one once
+    //
+    if( dir < 0 || dir >= dirs.count() || name < 0 || name >= files.count() )
+        return false;
+
+    quint64 key = ( ( quint64 )dir << 32 ) | ( uint )name;
+    QHash< quint64, bool >::const_iterator it( matched.constFind( key ) );
+    if( it != matched.constEnd() )
+        return it.value();
+
+    bool found = ( dirs.at( dir ) + files.at( name ) ).contains( rx );
+    matched.insert( key, found );
+    return found;
+}
+
 void
-Git::getFileFilter( SCRef path, ShaSet& shaSet ) const
+Git::getFileFilter( SCRef path, ShaSet& shaSet )
 {
+    //
+    // Records of the file names cache not looked up yet are scanned
+    // in place in the mapping, no RevFile is built for them
+    //
     shaSet.clear();
-    QRegExp rx( path, Qt::CaseInsensitive, QRegExp::Wildcard );
+    QRegExp rx( path, Qt::CaseInsensitive, QRegExp::Wildcard );  // Case insensitive, wildcard
+    QHash< quint64, bool > matched;
+
     FOREACH( ShaVect, it, revData->revOrder )
     {
-        if( !revsFiles.contains( *it ) )
-            continue;
-
-        // Case insensitive, wildcard search
-        const RevFile* rf = revsFiles[ *it ];
-        for( int i = 0; i < rf->count(); ++i )
-            if( filePath( *rf, i ).contains( rx ) )
-            {
-                shaSet.insert( *it );
-                break;
-            }
+        bool found = false;
+        const RevFile* rf = revsFiles.value( *it );
+        if( rf )
+        {
+            for( int i = 0; i < rf->count() && !found; ++i )
+                found = matchPath( rx, dirNamesVec, fileNamesVec, rf->dirAt( i ), rf->nameAt( i ),
+                                   matched );
+        }
+        else if( filesCache->isOpen() )
+        {
+            int idx = filesCache->find( *it ), cnt = 0;
+            const uchar* p = ( idx != -1 ? filesCache->paths( idx, &cnt ) : NULL );
+            for( int i = 0; i < cnt && !found; ++i )
+                found = matchPath( rx, dirNamesVec, fileNamesVec,
+                                   ( int )qFromLittleEndian< quint32 >( p + i * 4 ),
+                                   ( int )qFromLittleEndian< quint32 >( p + ( cnt + i ) * 4 ),
+                                   matched );
+        }
+        if( found )
+            shaSet.insert( *it );
     }
 }
 
@@ -1857,37 +2210,66 @@ Git::stgPop( SCRef sha )
 }
 
 //
-//! cache for dates conversion. Common among qgit windows
+//! calendar cache for dates conversion, UTC offset of local time by UTC day,
+//! DST_CHANGE if it changes during the day. Common among qgit windows
 //
-static QHash< QString, QString > localDates;
+#define DST_CHANGE 1000000  // not a valid offset
+static QHash< int, int > utcOffsets;
+
+static int
+utcOffset( uint t )
+{
+    QDateTime d;
+    d.setTime_t( t );
+    QDateTime asUtc( d.date(), d.time(), Qt::UTC );
+    return ( int )( asUtc.toTime_t() - t );
+}
+
 /**
- * Accesses a cache that avoids slow date calculation
+ * Converts a git date to local time, the slow time zone conversion
+ * is done once per day through a calendar cache
  *
- * @param gitDate
- *   the reference from which we want to get the date
+ * @param t
+ *   seconds since epoch, as in git author date
  *
  * @return
  *   human-readable date
  **/
 const QString
-Git::getLocalDate( SCRef gitDate )
+Git::getLocalDate( uint t )
 {
-    QString localDate( localDates.value( gitDate ) );
-
-    // Cache miss
-    if( localDate.isEmpty() )
+    int day = t / 86400;
+    int ofs;
+    QHash< int, int >::const_iterator it( utcOffsets.constFind( day ) );
+    if( it != utcOffsets.constEnd() )
+        ofs = *it;
+    else
     {
-        static QDateTime d;
-        d.setTime_t( gitDate.toUInt() );
-        localDate = d.toString( Qt::SystemLocaleShortDate );
+        ofs = utcOffset( day * 86400 );
+        if( utcOffset( day * 86400 + 86399 ) != ofs )
+            ofs = DST_CHANGE;
 
+        utcOffsets.insert( day, ofs );
+    }
+    QDateTime d;
+    if( ofs == DST_CHANGE )
+        d.setTime_t( t );
+    else
+    {
         //
-        // Save to cache
+        // Local time is UTC plus the day offset, a date
+        // with UTC spec is formatted with no conversion
         //
-        localDates[ gitDate ] = localDate;
+        d.setTimeSpec( Qt::UTC );
+        d.setTime_t( t + ofs );
     }
+    return d.toString( Qt::SystemLocaleShortDate );
+}
 
-    return localDate;
+const QString
+Git::getLocalDate( SCRef gitDate )
+{
+    return getLocalDate( gitDate.toUInt() );
 }
 
 const QStringList
@@ -2238,7 +2620,7 @@ Git::fakeRevData( SCRef sha, SCList parents, SCRef author, SCRef date, SCRef log
 
     fh->rowData.append( ba );
     int dummy;
-    Rev* c = new Rev( *ba, 0, idx, &dummy, !isMainHistory( fh ) );
+    Rev* c = fh->arena.newRev( *ba, 0, idx, &dummy, !isMainHistory( fh ) );
     return c;
 }
 
@@ -2254,7 +2636,7 @@ Git::fakeWorkDirRev( SCRef parent, SCRef log, SCRef longLog, int idx, FileHistor
     QStringList parents( parent );
     Rev* c = fakeRevData( ZERO_SHA, parents, author, date, log, longLog, patch, idx, fh );
     c->isDiffCache = true;
-    c->lanes.append( EMPTY );
+    c->lanes.append( EMPTY, fh->arena );
     return c;
 }
 
@@ -2325,7 +2707,7 @@ Git::getDiffIndex()
     SCRef log = ( isNothingToCommit() ? "Nothing to commit" : "Working directory changes" );
     const Rev* r = fakeWorkDirRev( head, log, status, revData->revOrder.count(), revData );
     revData->revs.insert( ZERO_SHA_RAW, r );
-    revData->revOrder.append( ZERO_SHA_RAW );
+    revData->appendRev( ZERO_SHA_RAW, r );
     revData->earlyOutputCntBase = revData->revOrder.count();
 
     //
@@ -2374,11 +2756,35 @@ Git::parseDiffFormatLine( RevFile& rf, SCRef line, int parNum, FileNamesLoader&
     }
 }
 
+void
+Git::parseDiffFormatLine( RevFile& rf, const char* line, int len, int parNum,
+                          FileNamesLoader& fl )
+{
+    //
+    // Raw bytes version, only the fast path is handled here,
+    // combined merges, renames and copies are rare enough to
+    // be decoded and parsed as above
+    //
+    if( len > 99 && line[ 1 ] != ':' && line[ 98 ] == '\t' )
+    {
+        appendFileName( rf, line + 99, len - 99, fl );
+        setStatus( rf, line[ 97 ] );
+        rf.mergeParent.append( parNum );
+    }
+    else
+        parseDiffFormatLine( rf, QString::fromUtf8( line, len ), parNum, fl );
+}
+
 // TODO: can go in RevFile
 void
 Git::setStatus( RevFile& rf, SCRef rowSt )
 {
-    char status = rowSt.at( 0 ).toLatin1();
+    setStatus( rf, rowSt.at( 0 ).toLatin1() );
+}
+
+void
+Git::setStatus( RevFile& rf, char status )
+{
     switch( status )
     {
     case 'M':
@@ -2402,7 +2808,7 @@ Git::setStatus( RevFile& rf, SCRef rowSt )
         dbp(
             "ASSERT in Git::setStatus, unknown status <%1>. "
             "'MODIFIED' will be used instead.",
-            rowSt );
+            QString( QChar( status ) ) );
         rf.status.append( RevFile::MODIFIED );
         break;
     }
@@ -2497,7 +2903,7 @@ Git::startParseProc( SCList initCmd, FileHistory* fh, SCRef buf )
 }
 
 bool
-Git::startRevList( SCList args, FileHistory* fh )
+Git::startRevList( SCList args, FileHistory* fh, SCRef buf )
 {
     QString baseCmd(
         "git log --topo-order --no-color "
@@ -2509,10 +2915,14 @@ Git::startRevList( SCList args, FileHistory* fh )
         "--pretty=format:%m%HX%PX%n%cn<%ce>%n%an<%ae>%n%at%n%s%n" );
 
     //
-    // We don't need log message body for file history
+    // Log message body is not loaded, that is most of the output. For
+    // main history it is read only when needed, see getLongLog()
     //
-    if( isMainHistory( fh ) )
-        baseCmd.append( "%b" );
+    //
+    // Old tips of a delta load are already in cache, do not show them
+    //
+    if( loadingRevDelta && isMainHistory( fh ) )
+        baseCmd.remove( "--boundary " );
 
     QStringList initCmd( baseCmd.split( ' ' ) );
     if( !isMainHistory( fh ) )
@@ -2526,71 +2936,478 @@ Git::startRevList( SCList args, FileHistory* fh )
         //
         initCmd << QString( "-r -m -p --full-index" ).split( ' ' );
     }
-    else
+    else if( !loadingRevDelta && !isStGIT )
     {
-        // initCmd << QString("--early-output"); // NOTE: currently disabled
+        //
+        // Let git send the first screen of history as soon as it has
+        // it, final output is reconciled by filterEarlyOutputRev()
+        //
+        initCmd << QString( "--early-output" );
     }
 
-    return startParseProc( initCmd + args, fh, QString() );
+    return startParseProc( initCmd + args, fh, buf );
 }
 
 bool
-Git::startUnappliedList()
+Git::isLimitedLoad( SCList args )
 {
-    QStringList unAppliedShaList( getAllRefSha( UN_APPLIED ) );
-    if( unAppliedShaList.isEmpty() )
-        return false;
-
     //
-    // NOTE: WARNING: with this command 'git log' could send spurious
-    // revs so we need some filter out logic during loading
+    // With a count, a skip or a date limit the loaded history is not
+    // the one reachable from the tips. It could change with no tip
+    // moved, e.g. '--since=2.weeks.ago', and revisions newer than the
+    // cached ones do not simply come before them
     //
-    QString cmd(
-        "git log --no-color --parents -z "
-
-#ifndef Q_OS_WIN32
-        "--log-size "  // FIXME broken on Windows
-#endif
-        "--pretty=format:%m%HX%PX%n%an<%ae>%n%at%n%s%n%b ^HEAD" );
+    QRegExp limitRe( "^(-n|-[0-9]+$|--(max-count|skip|since|after|until|before|"
+                     "max-age|min-age)(=|$))" );
+    FOREACH_SL( it, args )
+    {
+        if( *it == "--" )
+            break;
 
-    QStringList sl( cmd.split( ' ' ) );
-    sl << unAppliedShaList;
-    return startParseProc( sl, revData, QString() );
+        if( limitRe.indexIn( *it ) != -1 )
+            return true;
+    }
+    return false;
 }
 
-void
-Git::stop( bool saveCache )
+bool
+Git::startCachedRevList( SCList args )
 {
     //
-    // Normally called when changing directory or closing
-    //
-    EM_RAISE( exGitStopped );
-
-    //
-    // Stop all data sending from process and asks them
-    // to terminate. Note that process could still keep
-    // running for a while although silently
+    // Try to avoid a full 'git log' using the revisions cache, it
+    // is valid if saved with the same loading arguments. If their
+    // tips are unchanged the whole history is taken from the cache,
+    // otherwise only revisions newer than the cached ones are
+    // loaded and the cache is spliced after them, at the end.
+    // On refresh the history kept in memory by keepRevs() is
+    // used in the same way, in this case nothing is read from disk.
     //
-    emit cancelAllProcesses();  // Non blocking
+    bool noCache = ( loadArguments.filteredLoading || isStGIT || isLimitedLoad( args ) );
+    if( revCache && ( revCache->key != revCacheKey || noCache ) )
+    {
+        delete revCache;
+        revCache = NULL;
+    }
+    if( noCache )
+        return false;
 
     //
-    // After cancelAllProcesses() procFinished() is not called anymore
-    // TODO perhaps is better to call procFinished() also if process terminated
-    // incorrectly as QProcess does. BUt first we need to fix FileView::on_loadCompleted()
+    // Resolve the tips of the history about to be loaded, they
+    // identify it together with the arguments, '^' marks the
+    // excluded ones. With no tip at all git log starts from HEAD
     //
-    emit fileNamesLoad( 1, revsFiles.count() - filesLoadingStartOfs );
+    QString runOutput;
+    errorReportingEnabled = false;
+    bool ok = run( "git rev-parse --revs-only --no-flags " + args.join( " " ), &runOutput );
+    if( ok && !QString( '\n' + runOutput ).contains( QRegExp( "\n[0-9a-f]" ) ) )
+        ok = run( "git rev-parse --revs-only HEAD", &runOutput );
+    errorReportingEnabled = true;
 
-    if( cacheNeedsUpdate && saveCache )
+    revCacheTips = ( ok ? runOutput.trimmed() : "" );
+    if( revCacheTips.isEmpty() )
     {
-        cacheNeedsUpdate = false;
-        if( !filesLoadingCurSha.isEmpty() )  // We are in the middle of a loading
-            revsFiles.remove( toTempSha( filesLoadingCurSha ) );  // Remove partial data
+        delete revCache;
+        revCache = NULL;
+        return false;
+    }
+    QTime t;
+    t.start();
 
-        if( !revsFiles.isEmpty() )
+    if( !revCache )
+    {
+        revCache = new RevCache();
+        if( !Cache::loadRevs( gitDir, revCacheKey, *revCache ) )
         {
-            SHOW_MSG( "Saving cache. Please wait..." );
-            if( !Cache::save( gitDir, revsFiles, dirNamesVec, fileNamesVec ) )
-                dbs( "ERROR unable to save file names cache" );
+            delete revCache;
+            revCache = NULL;
+            return false;
+        }
+    }
+    if( revCache->tips == revCacheTips )
+    {
+        ulong byteSize = revCache->revsData.size();
+        FOREACH( QList< QByteArray* >, it, revCache->rowData )
+        byteSize += ( *it )->size();
+
+        bool unsaved = revCache->unsaved;
+        spliceCachedRevs( true );
+        on_loaded( revData, byteSize, t.elapsed(), true, "", "" );
+        revCacheNeedsUpdate = unsaved;
+        revCacheLanesEnd = revData->firstFreeLane;
+        return true;
+    }
+    //
+    // Tips moved, new revisions are the ones reachable from the new
+    // tips but not from the old ones. This is correct only if all
+    // the cached revisions are still in the history to load, i.e.
+    // old tips are reachable from the new ones: no history has been
+    // rewritten and no loaded branch has been deleted. Excluded tips
+    // could bring back revisions not in cache, so a full load is done
+    //
+    if( revCache->tips.isEmpty() || ( revCache->tips + revCacheTips ).contains( '^' ) )
+    {
+        delete revCache;
+        revCache = NULL;
+        return false;
+    }
+    QString oldTips, newTips;
+    const QStringList oldLst( revCache->tips.split( '\n', QString::SkipEmptyParts ) );
+    FOREACH_SL( it, oldLst )
+    oldTips.append( *it ).append( '\n' );
+
+    const QStringList newLst( revCacheTips.split( '\n', QString::SkipEmptyParts ) );
+    FOREACH_SL( it, newLst )
+    newTips.append( '^' ).append( *it ).append( '\n' );
+
+    errorReportingEnabled = false;  // an old tip could be gone
+    ok = run( "git rev-list -n1 --stdin", &runOutput, NULL, oldTips + newTips );
+    errorReportingEnabled = true;
+
+    if( !ok || !runOutput.trimmed().isEmpty() )
+    {
+        delete revCache;
+        revCache = NULL;
+        return false;
+    }
+    //
+    // Tips are passed through stdin, there could be many thousands
+    //
+    QStringList deltaArgs( "--stdin" );
+    deltaArgs << args;
+    oldTips.replace( '\n', "\n^" ).prepend( '^' );
+    oldTips.chop( 1 );
+
+    loadingRevDelta = true;
+    if( !startRevList( deltaArgs, revData, oldTips ) )
+    {
+        loadingRevDelta = false;
+        delete revCache;
+        revCache = NULL;
+        return false;
+    }
+    return true;
+}
+
+void
+Git::spliceCachedRevs( bool withLanes )
+{
+    if( !revCache )
+        return;
+
+    FileHistory* fh = revData;
+    int firstRow = fh->revOrder.count();
+
+    if( !revCache->revs.isEmpty() )
+    {
+        spliceKeptRevs( withLanes );
+        return;
+    }
+    //
+    // Take ownership of the records buffer, that must not be shared
+    // because Rev::indexData() writes in place
+    //
+    QByteArray* ba = new QByteArray( revCache->revsData );
+    revCache->revsData.clear();
+    fh->rowData.append( ba );
+
+    int ofs = 0, next, bz = ba->size();
+    while( bz - ofs > 0 )
+    {
+        Rev* rev = fh->arena.newRev( *ba, ofs, 0, &next, false );
+        if( next < 0 )
+        {
+            fh->arena.release( rev );
+            dbs( "ASSERT in spliceCachedRevs, corrupted revisions cache" );
+            break;
+        }
+        addRev( fh, rev );
+        ofs = next;
+    }
+    //
+    // Lanes computation will continue lazily from the restored Lanes
+    // state. Cached lanes are valid only after the same rows in front,
+    // as the working directory one, so the check is skipped on a delta
+    //
+    const QVector< int >& lo = revCache->lanesOfs;
+    int lanesRows = lo.count() - 1;
+    if( withLanes && lanesRows > 0 && firstRow + lanesRows <= fh->revOrder.count() &&
+        firstRow == revCache->firstRow && continueLanes( fh, firstRow, revCache->lanesStart ) )
+    {
+        const QByteArray& lanesData = revCache->lanesData;
+        RevLanes prev;
+        for( int i = 0; i < lanesRows; i++ )
+        {
+            Rev* r = const_cast< Rev* >( fh->revAt( firstRow + i ) );
+            r->lanes.assign( lanesData.mid( lo[ i ], lo[ i + 1 ] - lo[ i ] ), prev, fh->arena );
+            prev = r->lanes;
+        }
+        QDataStream stream( revCache->lanesState );
+        *fh->lns << stream;
+        fh->firstFreeLane = firstRow + lanesRows;
+    }
+    delete revCache;
+    revCache = NULL;
+}
+
+RevCache*
+Git::keepRevs()
+{
+    //
+    // On refresh the already loaded history is kept to be spliced
+    // after the new revisions, so that only these are loaded. This
+    // is possible only if main history has been completely loaded.
+    // Working directory rev is not kept, getDiffIndex() builds it again
+    //
+    FileHistory* fh = revData;
+    if( revCacheLanesEnd == -1 || loadingRevDelta || loadArguments.filteredLoading || isStGIT ||
+        fh->revOrder.isEmpty() )
+        return NULL;
+
+    RevCache* rc = new RevCache();
+    rc->key = revCacheKey;
+    rc->tips = revCacheTips;
+    rc->unsaved = revCacheNeedsUpdate || ( int )fh->firstFreeLane > revCacheLanesEnd;
+    rc->revs.reserve( fh->revOrder.count() );
+
+    FOREACH( ShaVect, it, fh->revOrder )
+    {
+        if( *it == ZERO_SHA_RAW )
+            rc->firstRow++;
+        else
+            rc->revs.append( const_cast< Rev* >( fh->revs.take( *it ) ) );
+    }
+    if( rc->revs.isEmpty() )
+    {
+        delete rc;
+        return NULL;
+    }
+    rc->arena.take( fh->arena );  // working directory rev too, unused
+    if( ( int )fh->firstFreeLane > rc->firstRow )
+    {
+        rc->lanesRows = fh->firstFreeLane - rc->firstRow;
+        rc->lanesStart = lanesStateAt( fh, rc->firstRow );
+        QDataStream stream( &rc->lanesState, QIODevice::WriteOnly );
+        *fh->lns >> stream;
+    }
+    //
+    // Take all the buffers but the one of working directory rev,
+    // that is not kept and will be deleted by FileHistory::clear()
+    //
+    const Rev* zr = fh->revs.value( ZERO_SHA_RAW );
+    const char* zrData = ( zr ? zr->sha().latin1() : NULL );
+    for( int i = fh->rowData.count() - 1; i >= 0; i-- )
+    {
+        const QByteArray* b = fh->rowData.at( i );
+        if( zrData && zrData >= b->constData() && zrData < b->constData() + b->size() )
+            continue;
+
+        rc->rowData.prepend( fh->rowData.takeAt( i ) );
+    }
+    rc->mappedFiles = fh->mappedFiles;
+    fh->mappedFiles.clear();
+    return rc;
+}
+
+void
+Git::spliceKeptRevs( bool withLanes )
+{
+    //
+    // Revisions kept by keepRevs() are appended after the new ones, if
+    // any, and moved down by the number of rows in front of them. Lanes
+    // are still valid only if tips did not change and the rows in front
+    // leave the same Lanes state, because new revisions could change lanes
+    // of all the following rows. Children and near refs are row indexed
+    // in FileHistory, so are always computed again
+    //
+    FileHistory* fh = revData;
+    int firstRow = fh->revOrder.count();
+    bool keepLanes = ( withLanes && revCache->lanesRows > 0 && firstRow == revCache->firstRow &&
+                       continueLanes( fh, firstRow, revCache->lanesStart ) );
+
+    fh->rowData << revCache->rowData;
+    fh->mappedFiles << revCache->mappedFiles;
+    revCache->rowData.clear();
+    revCache->mappedFiles.clear();
+    fh->arena.take( revCache->arena );
+
+    FOREACH( QVector< Rev* >, it, revCache->revs )
+    {
+        Rev* rev = *it;
+        if( !keepLanes )
+            rev->lanes.clear();
+
+        addRev( fh, rev );
+    }
+    revCache->revs.clear();
+
+    if( keepLanes )
+    {
+        QDataStream stream( revCache->lanesState );
+        *fh->lns << stream;
+        fh->firstFreeLane = firstRow + revCache->lanesRows;
+    }
+    delete revCache;
+    revCache = NULL;
+}
+
+void
+Git::saveRevCache()
+{
+    if( loadArguments.filteredLoading || isStGIT )
+        return;
+
+    RevCache rc;
+    rc.key = revCacheKey;
+    rc.tips = revCacheTips;
+
+    FileHistory* fh = revData;
+    int lanesRows = 0;
+    rc.lanesOfs.append( 0 );
+
+    for( int i = 0; i < fh->revOrder.count(); i++ )
+    {
+        if( fh->revOrder.at( i ) == ZERO_SHA_RAW )
+        {
+            rc.firstRow++;
+            continue;
+        }
+        const Rev* r = fh->revAt( i );
+        rc.revsData.append( r->rawData() );
+
+        //
+        // Only the leading rows have lanes, those below
+        // firstFreeLane have not been computed yet
+        //
+        if( r->orderIdx >= ( int )fh->firstFreeLane )
+            continue;
+
+        rc.lanesData.append( r->lanes.decode() );
+
+        rc.lanesOfs.append( rc.lanesData.size() );
+        lanesRows++;
+    }
+    if( lanesRows > 0 )
+    {
+        rc.lanesStart = lanesStateAt( fh, rc.firstRow );
+        QDataStream stream( &rc.lanesState, QIODevice::WriteOnly );
+        *fh->lns >> stream;
+    }
+    else
+        rc.lanesOfs.clear();
+
+    if( !Cache::saveRevs( gitDir, rc ) )
+        dbs( "ERROR unable to save revisions cache" );
+}
+
+const QByteArray
+Git::lanesStateAt( FileHistory* fh, int row )
+{
+    //
+    // Streamed Lanes state before the given row, lanes of
+    // the rows in front are computed again on a scratch
+    // Lanes, rewriting them with the same values
+    //
+    Lanes lns;
+    for( int i = 0; i < row; i++ )
+        updateLanes( *const_cast< Rev* >( fh->revAt( i ) ), lns, fh->revOrder.at( i ), fh->arena );
+
+    QByteArray state;
+    QDataStream stream( &state, QIODevice::WriteOnly );
+    lns >> stream;
+    return state;
+}
+
+bool
+Git::continueLanes( FileHistory* fh, int row, const QByteArray& state )
+{
+    //
+    // Lanes of spliced rows can be restored only if the rows in front
+    // of them, normally just the working directory one, leave the same
+    // Lanes state they had when saved. So lanes of these rows are
+    // computed now, the lanes pass would do it anyway
+    //
+    if( fh->firstFreeLane > ( uint )row )
+        return false;
+
+    setLanes( fh, row );
+
+    QByteArray cur;
+    QDataStream stream( &cur, QIODevice::WriteOnly );
+    *l >> stream;
+    return ( cur == state );
+}
+
+bool
+Git::startUnappliedList()
+{
+    QStringList unAppliedShaList( getAllRefSha( UN_APPLIED ) );
+    if( unAppliedShaList.isEmpty() )
+        return false;
+
+    //
+    // NOTE: WARNING: with this command 'git log' could send spurious
+    // revs so we need some filter out logic during loading
+    //
+    QString cmd(
+        "git log --no-color --parents -z "
+
+#ifndef Q_OS_WIN32
+        "--log-size "  // FIXME broken on Windows
+#endif
+        "--pretty=format:%m%HX%PX%n%an<%ae>%n%at%n%s%n%b ^HEAD" );
+
+    QStringList sl( cmd.split( ' ' ) );
+    sl << unAppliedShaList;
+    return startParseProc( sl, revData, QString() );
+}
+
+void
+Git::stop( bool saveCache )
+{
+    //
+    // Normally called when changing directory or closing
+    //
+    EM_RAISE( exGitStopped );
+
+    //
+    // Stop all data sending from process and asks them
+    // to terminate. Note that process could still keep
+    // running for a while although silently
+    //
+    emit cancelAllProcesses();  // Non blocking
+
+    //
+    // After cancelAllProcesses() procFinished() is not called anymore
+    // TODO perhaps is better to call procFinished() also if process terminated
+    // incorrectly as QProcess does. BUt first we need to fix FileView::on_loadCompleted()
+    //
+    emit fileNamesLoad( 1, filesLoadedCnt );
+
+    //
+    // Only complete RevFile are merged, so the
+    // loaded file names are never partial
+    //
+    clearDiffTreeLoaders();
+    clearTreeIndexer();  // Near refs are not needed anymore
+    cancelLongLogs( revData );  // Its process has been canceled
+
+    if( saveCache && revCacheLanesEnd != -1 && !loadingRevDelta &&
+        ( revCacheNeedsUpdate || ( int )revData->firstFreeLane > revCacheLanesEnd ) )
+    {
+        SHOW_MSG( "Saving revisions cache. Please wait..." );
+        saveRevCache();
+        revCacheNeedsUpdate = false;
+        revCacheLanesEnd = -1;
+    }
+
+    if( cacheNeedsUpdate && saveCache )
+    {
+        cacheNeedsUpdate = false;
+        if( !revsFiles.isEmpty() )
+        {
+            SHOW_MSG( "Saving cache. Please wait..." );
+            if( !Cache::save( gitDir, revsFiles, *filesCache, dirNamesVec, fileNamesVec ) )
+                dbs( "ERROR unable to save file names cache" );
         }
     }
 }
@@ -2598,18 +3415,25 @@ Git::stop( bool saveCache )
 void
 Git::clearRevs()
 {
+    clearTreeIndexer();  // Before rows it publishes to
     revData->clear();
     patchesStillToFind = 0;  // TODO: TEST WITH FILTERING
     firstNonStGitPatch = "";
     workingDirInfo.clear();
     revsFiles.remove( ZERO_SHA_RAW );
+    delete revCache;
+    revCache = NULL;
+    loadingRevDelta = revCacheNeedsUpdate = false;
+    revCacheLanesEnd = -1;
 }
 
 void
 Git::clearFileNames()
 {
+    clearDiffTreeLoaders();
     qDeleteAll( revsFiles );
     revsFiles.clear();
+    filesCache->close();
     fileNamesMap.clear();
     dirNamesMap.clear();
     dirNamesVec.clear();
@@ -2626,7 +3450,9 @@ Git::init( SCRef wd, bool askForRange, const QStringList* passedArgs, bool overw
     // Normally called when changing git directory. Must be called after stop()
     //
     *quit = false;
+    RevCache* keptRevs = ( !startup && !askForRange && !passedArgs ? keepRevs() : NULL );
     clearRevs();
+    revCache = keptRevs;  // Spliced after new revisions, if any, by init2()
 
     //
     // We only update filtering info here, original arguments
@@ -2654,9 +3480,12 @@ Git::init( SCRef wd, bool askForRange, const QStringList* passedArgs, bool overw
 
         if( repoChanged )
         {
+            delete revCache;
+            revCache = NULL;
+
             bool dummy;
             getBaseDir( wd, workDir, dummy );
-            localDates.clear();
+            utcOffsets.clear();
             clearFileNames();
             fileCacheAccessed = false;
 
@@ -2776,7 +3605,8 @@ Git::init2()
 
             args << loadArguments.filterList;
         }
-        if( !startRevList( args, revData ) )
+        revCacheKey = args.join( " " );
+        if( !startCachedRevList( args ) && !startRevList( args, revData ) )
             SHOW_MSG( "ERROR: unable to start 'git log'" );
 
         setThrowOnStop( false );
@@ -2815,6 +3645,17 @@ Git::on_loaded( FileHistory* fh, ulong byteSize, int loadTime, bool normalExit,
     }
     if( normalExit )
     {
+        if( loadingRevDelta && isMainHistory( fh ) )
+        {
+            //
+            // New revisions are in, now append the cached ones
+            //
+            loadingRevDelta = false;
+            spliceCachedRevs( false );
+        }
+        if( !loadingUnAppliedPatches )
+            indexTopology( fh );
+
         //
         // Do not send anything if killed
         //
@@ -2837,6 +3678,9 @@ Git::on_loaded( FileHistory* fh, ulong byteSize, int loadTime, bool normalExit,
 
             if( isMainHistory( fh ) )
             {
+                revCacheNeedsUpdate = true;
+                revCacheLanesEnd = 0;
+
                 //
                 // Wait the dust to settle down before to start
                 // background file names loading for new revisions
@@ -2958,10 +3802,16 @@ Git::loadFileCache()
     {
         fileCacheAccessed = true;
         QByteArray shaBuf;
-        if( Cache::load( gitDir, revsFiles, dirNamesVec, fileNamesVec, shaBuf ) )
+        if( Cache::load( gitDir, *filesCache, dirNamesVec, fileNamesVec, revsFiles, shaBuf ) )
         {
             revsFilesShaBackupBuf.append( shaBuf );
             populateFileNamesMap();
+
+            //
+            // Old format cache is loaded in revsFiles, convert it on exit
+            //
+            if( !revsFiles.isEmpty() )
+                cacheNeedsUpdate = true;
         }
         else
             dbs( "ERROR: unable to load file names cache" );
@@ -2973,32 +3823,144 @@ Git::loadFileNames()
 {
     indexTree();  // We are sure data loading is finished at this point
 
-    int revCnt = 0;
-    QString diffTreeBuf;
-    FOREACH( ShaVect, it, revData->revOrder )
+    clearDiffTreeLoaders();
+
+    ShaVect todo;
+    const ShaVect& ro = revData->revOrder;
+    for( int i = 0; i < ro.count(); i++ )
+    {
+        if( revData->revAt( i )->parentsCount() == 1 &&  // Skip initials and merges
+            !hasRevFile( ro.at( i ) ) )
+            todo.append( ro.at( i ) );
+    }
+    if( todo.isEmpty() )
+        return;
+
+    filesLoadedCnt = 0;
+    emit fileNamesLoad( 3, todo.count() );
+
+    //
+    // Split the list in contiguous slices, one 'git diff-tree' process
+    // each, parsed in parallel and merged back in order. Small lists
+    // are not worth more than one process
+    //
+    int procCnt = qBound( 1, QThread::idealThreadCount(), MAX_DIFF_TREE_PROCS );
+    procCnt = qMin( procCnt, 1 + todo.count() / MIN_DIFF_TREE_REVS );
+
+    const QString runCmd( "git diff-tree --no-color -r -C --stdin" );
+    for( int i = 0; i < procCnt; i++ )
+    {
+        QString diffTreeBuf;
+        int last = ( i + 1 ) * todo.count() / procCnt;
+        for( int j = i * todo.count() / procCnt; j < last; j++ )
+            diffTreeBuf.append( todo[ j ] ).append( '\n' );
+
+        DiffTreeLoader* dl = new DiffTreeLoader( this );
+        connect( dl, SIGNAL( newFileNames() ), this, SLOT( on_fileNamesReady() ) );
+        diffTreeLoaders.append( dl );
+        dl->start();
+
+        MyProcess* p = runAsync( runCmd, dl, diffTreeBuf );
+        if( p )
+            diffTreeProcs.append( p );
+        else
+            dl->procFinished();  // Nothing to wait for
+    }
+}
+
+void
+Git::on_fileNamesReady()
+{
+    //
+    // Loaders are merged in order, the first not finished
+    // one holds back the results of the following ones
+    //
+    if( diffTreeLoaders.isEmpty() )
+        return;  // Stale signal, loading has been stopped
+
+    int pendingCnt = 0;
+    for( int i = diffTreeMerged; i < diffTreeLoaders.count(); i++ )
     {
-        if( !revsFiles.contains( *it ) )
+        DiffTreeLoader* dl = diffTreeLoaders[ i ];
+        if( i > diffTreeMerged )
         {
-            const Rev* c = revLookup( *it );
-            if( c->parentsCount() == 1 )
-            {
-                //
-                // Skip initials and merges
-                //
-                diffTreeBuf.append( *it ).append( '\n' );
-                revCnt++;
-            }
+            pendingCnt += dl->parsedCount();
+            continue;
         }
+        bool done = dl->isDone();  // Read before taking the last batches
+
+        FileNamesBatch* b;
+        while( ( b = dl->takeBatch() ) != NULL )
+        {
+            mergeFileNames( b, dl->dirsRemap, dl->filesRemap );
+            delete b;
+        }
+        if( done )
+            diffTreeMerged++;
     }
-    if( !diffTreeBuf.isEmpty() )
+    if( diffTreeMerged < diffTreeLoaders.count() )
     {
-        filesLoadingPending = filesLoadingCurSha = "";
-        filesLoadingStartOfs = revsFiles.count();
-        emit fileNamesLoad( 3, revCnt );
+        emit fileNamesLoad( 2, filesLoadedCnt + pendingCnt );
+        return;
+    }
+    clearDiffTreeLoaders();
+    emit fileNamesLoad( 1, filesLoadedCnt );
+}
 
-        const QString runCmd( "git diff-tree --no-color -r -C --stdin" );
-        runAsync( runCmd, this, diffTreeBuf );
+void
+Git::mergeFileNames( FileNamesBatch* b, QVector< int >& dirsRemap, QVector< int >& filesRemap )
+{
+    //
+    // Names interned by the loader since its previous batch
+    // come first, then RevFile indices are mapped to ours
+    //
+    FOREACH( StrVect, it, b->newDirs )
+    dirsRemap.append( internName( *it, dirNamesVec, dirNamesMap ) );
+
+    FOREACH( StrVect, it, b->newFiles )
+    filesRemap.append( internName( *it, fileNamesVec, fileNamesMap ) );
+
+    for( int i = 0; i < b->files.count(); i++ )
+    {
+        RevFile* rf = b->files[ i ];
+        int* d = ( int* )rf->pathsIdx.data();
+        for( int y = 0, cnt = rf->count(); y < cnt; y++ )
+        {
+            d[ y ] = dirsRemap.at( d[ y ] );
+            d[ cnt + y ] = filesRemap.at( d[ cnt + y ] );
+        }
+        SCRef sha = b->shas[ i ];
+        if( hasRevFile( toTempSha( sha ) ) )
+        {
+            dbp( "ASSERT: repeated sha %1 in file names loading", sha );
+            delete rf;
+            continue;
+        }
+        revsFiles.insert( toPersistentSha( sha, revsFilesShaBackupBuf ), rf );
+        cacheNeedsUpdate = true;
+        filesLoadedCnt++;
     }
+    b->files.clear();  // Now owned by revsFiles
+}
+
+void
+Git::clearDiffTreeLoaders()
+{
+    //
+    // Kill still running processes and wait for them before deleting
+    // the loaders they feed, no output is delivered after cancel. The
+    // finished ones are auto-deleted and their pointers are NULL
+    //
+    FOREACH( QVector< QPointer< MyProcess > >, it, diffTreeProcs )
+    {
+        MyProcess* p = *it;
+        if( p && p->state() != QProcess::NotRunning )
+            p->on_cancel();
+    }
+    diffTreeProcs.clear();
+    qDeleteAll( diffTreeLoaders );
+    diffTreeLoaders.clear();
+    diffTreeMerged = 0;
 }
 
 bool
@@ -3017,7 +3979,7 @@ Git::filterEarlyOutputRev( FileHistory* fh, Rev* rev )
                 // overwrite 'c' upon returning
                 //
                 rev->orderIdx = c->orderIdx;
-                revData->clear( false );  // flush the tail
+                fh->clear( false );  // flush the tail
             }
             else
                 return true;  // Filter out 'rev'
@@ -3033,7 +3995,6 @@ Git::filterEarlyOutputRev( FileHistory* fh, Rev* rev )
 int
 Git::addChunk( FileHistory* fh, const QByteArray& ba, int start )
 {
-    RevMap& r = fh->revs;
     int nextStart;
     Rev* rev;
 
@@ -3042,11 +4003,12 @@ Git::addChunk( FileHistory* fh, const QByteArray& ba, int start )
         //
         // Only here we create a new rev
         //
-        rev = new Rev( ba, start, fh->revOrder.count(), &nextStart, !isMainHistory( fh ) );
+        rev = fh->arena.newRev( ba, start, fh->revOrder.count(), &nextStart,
+                                !isMainHistory( fh ) );
 
         if( nextStart == -2 )
         {
-            delete rev;
+            fh->arena.release( rev );
             fh->setEarlyOutputState( true );
             start = ba.indexOf( '\n', start ) + 1;
         }
@@ -3058,16 +4020,29 @@ Git::addChunk( FileHistory* fh, const QByteArray& ba, int start )
         //
         // Half chunk detected
         //
-        delete rev;
+        fh->arena.release( rev );
         return -1;
     }
+    addRev( fh, rev );
+    return nextStart;
+}
+
+void
+Git::addRev( FileHistory* fh, Rev* rev )
+{
+    //
+    // Revisions could be parsed in advance, out of the GUI thread,
+    // so loading position is known only now
+    //
+    RevMap& r = fh->revs;
+    rev->orderIdx = fh->revOrder.count();
 
     const ShaString& sha = rev->sha();
 
     if( fh->earlyOutputCnt != -1 && filterEarlyOutputRev( fh, rev ) )
     {
-        delete rev;
-        return nextStart;
+        fh->arena.release( rev );
+        return;
     }
 
     if( isStGIT )
@@ -3080,8 +4055,8 @@ Git::addChunk( FileHistory* fh, const QByteArray& ba, int start )
             Reference* rf = lookupReference( sha );
             if( !( rf && ( rf->type & UN_APPLIED ) ) )
             {
-                delete rev;
-                return nextStart;
+                fh->arena.release( rev );
+                return;
             }
         }
         //
@@ -3101,8 +4076,8 @@ Git::addChunk( FileHistory* fh, const QByteArray& ba, int start )
             Reference* rf = lookupReference( sha );
             if( !( rf && ( rf->type & APPLIED ) ) )
             {
-                delete rev;
-                return nextStart;
+                fh->arena.release( rev );
+                return;
             }
         }
         if( r.contains( sha ) )
@@ -3113,8 +4088,8 @@ Git::addChunk( FileHistory* fh, const QByteArray& ba, int start )
             //
             if( r[ sha ]->isUnApplied )
             {
-                delete rev;
-                return nextStart;
+                fh->arena.release( rev );
+                return;
             }
             //
             // Could be a side effect of 'git log -m', see below
@@ -3141,8 +4116,11 @@ Git::addChunk( FileHistory* fh, const QByteArray& ba, int start )
                          rev->longLog(), fh->renamedPatches[ sha ], prevSha->orderIdx, fh );
 
         r.insert( sha, c );  // Overwrite old content
+        int row = prevSha->orderIdx;
+        if( row < fh->rowRevs.count() && fh->rowRevs.at( row ) == prevSha )
+            fh->rowRevs[ row ] = c;
         fh->renamedPatches.remove( sha );
-        return nextStart;
+        return;
     }
     if( !isMainHistory( fh ) && rev->parentsCount() > 1 && r.contains( sha ) )
     {
@@ -3159,13 +4137,13 @@ Git::addChunk( FileHistory* fh, const QByteArray& ba, int start )
             mergeSha = QString::number( ++i ) + " m " + sha;
         while( r.contains( toTempSha( mergeSha ) ) );
 
-        const ShaString& ss = toPersistentSha( mergeSha, shaBackupBuf );
+        const ShaString& ss = fh->arena.newSha( mergeSha );
         r.insert( ss, rev );
     }
     else
     {
         r.insert( sha, rev );
-        fh->revOrder.append( sha );
+        fh->appendRev( sha, rev );
 
         if( rev->parentsCount() == 0 && !isMainHistory( fh ) )
             fh->renamedRevs.append( sha );
@@ -3180,7 +4158,7 @@ Git::addChunk( FileHistory* fh, const QByteArray& ba, int start )
         {
             Rev* c = const_cast< Rev* >( revLookup( sha, fh ) );
             c->isUnApplied = true;
-            c->lanes.append( UNAPPLIED );
+            c->lanes.append( UNAPPLIED, fh->arena );
         }
         else if( patchesStillToFind > 0 || !isMainHistory( fh ) )
         {
@@ -3206,7 +4184,6 @@ Git::addChunk( FileHistory* fh, const QByteArray& ba, int start )
             }
         }
     }
-    return nextStart;
 }
 
 bool
@@ -3233,38 +4210,36 @@ Git::copyDiffIndex( FileHistory* fh, SCRef parent )
     //
     const Rev* rf = fakeWorkDirRev( parent, "Working directory changes", "long log\n", 0, fh );
     fh->revs.insert( ZERO_SHA_RAW, rf );
-    fh->revOrder.append( ZERO_SHA_RAW );
+    fh->appendRev( ZERO_SHA_RAW, rf );
     return true;
 }
 
 void
-Git::setLane( SCRef sha, FileHistory* fh )
+Git::setLanes( FileHistory* fh, int cnt )
 {
+    //
+    // Lanes of a row depend on all the rows above, so they are
+    // computed in one pass, in row order, up to the given row
+    //
     Lanes* l = fh->lns;
-    uint i = fh->firstFreeLane;
-    QVector< QByteArray > ba;
-    const ShaString& ss = toPersistentSha( sha, ba );
     const ShaVect& shaVec( fh->revOrder );
-
-    for( uint cnt = shaVec.count(); i < cnt; ++i )
+    cnt = qMin( cnt, shaVec.count() );
+    for( int i = fh->firstFreeLane; i < cnt; ++i )
     {
-        const ShaString& curSha = shaVec[ i ];
-        Rev* r = const_cast< Rev* >( revLookup( curSha, fh ) );
+        Rev* r = const_cast< Rev* >( fh->revAt( i ) );
         if( r->lanes.count() == 0 )
-            updateLanes( *r, *l, curSha );
-
-        if( curSha == ss )
-            break;
+            updateLanes( *r, *l, shaVec[ i ], fh->arena );
     }
-    fh->firstFreeLane = ++i;
+    fh->firstFreeLane = qMax( ( int )fh->firstFreeLane, cnt );
 }
 
 void
-Git::updateLanes( Rev& c, Lanes& lns, SCRef sha )
+Git::updateLanes( Rev& c, Lanes& lns, const ShaString& sha, RevArena& arena )
 {
     //
-    // We could get third argument from c.sha(), but we are in fast path here
-    // and c.sha() involves a deep copy, so we accept a little redundancy
+    // Lanes work on interned shas, so no string is
+    // built here, we are in fast path and called for
+    // each row, possibly with hundreds of lanes
     //
     if( lns.isEmpty() )
         lns.init( sha );
@@ -3282,17 +4257,21 @@ Git::updateLanes( Rev& c, Lanes& lns, SCRef sha )
     if( isFork )
         lns.setFork( sha );
     if( isMerge )
-        lns.setMerge( c.parents() );
+    {
+        ShaVect parents;
+        for( uint i = 0; i < c.parentsCount(); i++ )
+            parents.append( c.parent( i ) );
+
+        lns.setMerge( parents );
+    }
     if( c.isApplied )
         lns.setApplied();
     if( isInitial )
         lns.setInitial();
 
-    lns.getLanes( c.lanes );  // Here lanes are snapshotted
-
-    SCRef nextSha = ( isInitial ) ? "" : QString( c.parent( 0 ) );
+    lns.getLanes( c.lanes, arena );  // Here lanes are snapshotted
 
-    lns.nextParent( nextSha );
+    lns.nextParent( isInitial ? ShaString() : c.parent( 0 ) );
 
     if( c.isApplied )
         lns.afterApplied();
@@ -3311,59 +4290,6 @@ Git::updateLanes( Rev& c, Lanes& lns, SCRef sha )
     //	qDebug("%s %s", tmp.toUtf8().data(), sha.toUtf8().data());
 }
 
-void
-Git::procFinished()
-{
-    flushFileNames( fileLoader );
-    filesLoadingPending = filesLoadingCurSha = "";
-    emit fileNamesLoad( 1, revsFiles.count() - filesLoadingStartOfs );
-}
-
-void
-Git::procReadyRead( const QByteArray& fileChunk )
-{
-    if( filesLoadingPending.isEmpty() )
-        filesLoadingPending = fileChunk;
-    else
-        filesLoadingPending.append( fileChunk );  // Add to previous half lines
-
-    RevFile* rf = NULL;
-    if( !filesLoadingCurSha.isEmpty() && revsFiles.contains( toTempSha( filesLoadingCurSha ) ) )
-        rf = const_cast< RevFile* >( revsFiles[ toTempSha( filesLoadingCurSha ) ] );
-
-    int nextEOL = filesLoadingPending.indexOf( '\n' );
-    int lastEOL = -1;
-    while( nextEOL != -1 )
-    {
-        SCRef line( filesLoadingPending.mid( lastEOL + 1, nextEOL - lastEOL - 1 ) );
-        if( line.at( 0 ) != ':' )
-        {
-            SCRef sha = line.left( 40 );
-            if( !rf || sha != filesLoadingCurSha )
-            {
-                //
-                // New commit
-                //
-                rf = new RevFile();
-                revsFiles.insert( toPersistentSha( sha, revsFilesShaBackupBuf ), rf );
-                filesLoadingCurSha = sha;
-                cacheNeedsUpdate = true;
-            }
-            else
-                dbp( "ASSERT: repeated sha %1 in file names loading", sha );
-        }
-        else  // line.constref(0) == ':'
-            parseDiffFormatLine( *rf, line, 1, fileLoader );
-
-        lastEOL = nextEOL;
-        nextEOL = filesLoadingPending.indexOf( '\n', lastEOL + 1 );
-    }
-    if( lastEOL != -1 )
-        filesLoadingPending.remove( 0, lastEOL + 1 );
-
-    emit fileNamesLoad( 2, revsFiles.count() - filesLoadingStartOfs );
-}
-
 void
 Git::flushFileNames( FileNamesLoader& fl )
 {
@@ -3388,9 +4314,40 @@ Git::flushFileNames( FileNamesLoader& fl )
     fl.rf = NULL;
 }
 
+const RevFile*
+Git::revFileLookup( const ShaString& sha )
+{
+    //
+    // File names cache records become RevFile only when first needed
+    //
+    const RevFile* rf = revsFiles.value( sha );
+    if( rf || !filesCache->isOpen() )
+        return rf;
+
+    int idx = filesCache->find( sha );
+    if( idx == -1 )
+        return NULL;
+
+    rf = filesCache->revFile( idx );
+    revsFiles.insert( toPersistentSha( QString( sha ), revsFilesShaBackupBuf ), rf );
+    return rf;
+}
+
+bool
+Git::hasRevFile( const ShaString& sha ) const
+{
+    return ( revsFiles.contains( sha ) || filesCache->contains( sha ) );
+}
+
 void
 Git::appendFileName( RevFile& rf, SCRef name, FileNamesLoader& fl )
 {
+    if( fl.local )
+    {
+        const QByteArray ba( name.toUtf8() );
+        appendFileName( rf, ba.constData(), ba.size(), fl );
+        return;
+    }
     if( fl.rf != &rf )
     {
         flushFileNames( fl );
@@ -3400,246 +4357,158 @@ Git::appendFileName( RevFile& rf, SCRef name, FileNamesLoader& fl )
     SCRef dr = name.left( idx );
     SCRef nm = name.mid( idx );
 
-    QHash< QString, int >::const_iterator it( dirNamesMap.constFind( dr ) );
-    if( it == dirNamesMap.constEnd() )
-    {
-        int idx = dirNamesVec.count();
-        dirNamesMap.insert( dr, idx );
-        dirNamesVec.append( dr );
-        fl.rfDirs.append( idx );
-    }
-    else
-        fl.rfDirs.append( *it );
-
-    it = fileNamesMap.constFind( nm );
-    if( it == fileNamesMap.constEnd() )
-    {
-        int idx = fileNamesVec.count();
-        fileNamesMap.insert( nm, idx );
-        fileNamesVec.append( nm );
-        fl.rfNames.append( idx );
-    }
-    else
-        fl.rfNames.append( *it );
+    fl.rfDirs.append( internName( dr, dirNamesVec, dirNamesMap ) );
+    fl.rfNames.append( internName( nm, fileNamesVec, fileNamesMap ) );
 }
 
 void
-Git::updateDescMap( const Rev* r, uint idx, QHash< QPair< uint, uint >, bool >& dm,
-                    QHash< uint, QVector< int > >& dv )
+Git::appendFileName( RevFile& rf, const char* name, int len, FileNamesLoader& fl )
 {
-    QVector< int > descVec;
-    if( r->descRefsMaster != -1 )
+    //
+    // Local loaders only, names are interned by their raw bytes
+    //
+    if( fl.rf != &rf )
     {
-        const Rev* tmp = revLookup( revData->revOrder[ r->descRefsMaster ] );
-        const QVector< int >& nr = tmp->descRefs;
-
-        for( int i = 0; i < nr.count(); i++ )
-        {
-            if( !dv.contains( nr[ i ] ) )
-            {
-                dbp( "ASSERT descendant for %1 not found", r->sha() );
-                return;
-            }
-            const QVector< int >& dvv = dv[ nr[ i ] ];
-
-            //
-            // Copy the whole vector instead of each element
-            // in the first iteration of the loop below
-            //
-            descVec = dvv;  // quick (shared) copy
-
-            for( int y = 0; y < dvv.count(); y++ )
-            {
-                uint v = ( uint )dvv[ y ];
-                QPair< uint, uint > key = qMakePair( idx, v );
-                QPair< uint, uint > keyN = qMakePair( v, idx );
-                dm.insert( key, true );
-                dm.insert( keyN, false );
-                
-                //
-                // We don't want duplicated entry, otherwise 'dvv' grows
-                // greatly in repos with many tagged development branches
-                //
-                if( i > 0 && !descVec.contains( v ) )  // i > 0 is rare, no
-                    descVec.append( v );               // need to optimize
-            }
-        }
+        flushFileNames( fl );
+        fl.rf = &rf;
     }
-    descVec.append( idx );
-    dv.insert( idx, descVec );
+    int idx = len;
+    while( idx > 0 && name[ idx - 1 ] != '/' )
+        idx--;
+
+    fl.rfDirs.append( internName( name, idx, fl.dirNamesVec, fl.dirNamesMap ) );
+    fl.rfNames.append( internName( name + idx, len - idx, fl.fileNamesVec, fl.fileNamesMap ) );
 }
 
-void
-Git::mergeBranches( Rev* p, const Rev* r )
+int
+Git::internName( SCRef name, StrVect& vec, QHash< QString, int >& map )
 {
-    int r_descBrnMaster =
-        ( checkRef( r->sha(), BRANCH | RMT_BRANCH ) ? r->orderIdx : r->descBrnMaster );
+    QHash< QString, int >::const_iterator it( map.constFind( name ) );
+    if( it != map.constEnd() )
+        return *it;
 
-    if( p->descBrnMaster == r_descBrnMaster || r_descBrnMaster == -1 )
-        return;
+    int idx = vec.count();
+    map.insert( name, idx );
+    vec.append( name );
+    return idx;
+}
 
+int
+Git::internName( const char* name, int len, StrVect& vec, QHash< QByteArray, int >& map )
+{
     //
-    // We want all the descendant branches, so just avoid duplicates
+    // Lookup on raw data, names are copied and
+    // decoded only the first time they are seen
     //
-    const QVector< int >& src1 = revLookup( revData->revOrder[ p->descBrnMaster ] )->descBranches;
-    const QVector< int >& src2 = revLookup( revData->revOrder[ r_descBrnMaster ] )->descBranches;
-    QVector< int > dst( src1 );
-    for( int i = 0; i < src2.count(); i++ )
-        if( qFind( src1.constBegin(), src1.constEnd(), src2[ i ] ) == src1.constEnd() )
-            dst.append( src2[ i ] );
+    QHash< QByteArray, int >::const_iterator it(
+        map.constFind( QByteArray::fromRawData( name, len ) ) );
+    if( it != map.constEnd() )
+        return *it;
 
-    p->descBranches = dst;
-    p->descBrnMaster = p->orderIdx;
+    int idx = vec.count();
+    map.insert( QByteArray( name, len ), idx );
+    vec.append( QString::fromUtf8( name, len ) );
+    return idx;
 }
 
 void
-Git::mergeNearTags( bool down, Rev* p, const Rev* r, const QHash< QPair< uint, uint >, bool >& dm )
+Git::indexTopology( FileHistory* fh )
 {
-    bool isTag = checkRef( r->sha(), TAG );
-    int r_descRefsMaster = isTag ? r->orderIdx : r->descRefsMaster;
-    int r_ancRefsMaster = isTag ? r->orderIdx : r->ancRefsMaster;
-
-    if( down && ( p->descRefsMaster == r_descRefsMaster || r_descRefsMaster == -1 ) )
-        return;
-
-    if( !down && ( p->ancRefsMaster == r_ancRefsMaster || r_ancRefsMaster == -1 ) )
-        return;
-
     //
-    // We want the nearest tag only, so remove any tag
-    // that is ancestor of any other tag in p U r
+    // Resolve once the parents of each row to their row, so that
+    // graph walks do not need a sha lookup for each edge, then
+    // invert them to get children. Must be called when loading
+    // is complete, parents come after children
     //
-    const ShaVect& ro = revData->revOrder;
-    const ShaString& sha1 = down ? ro[ p->descRefsMaster ] : ro[ p->ancRefsMaster ];
-    const ShaString& sha2 = down ? ro[ r_descRefsMaster ] : ro[ r_ancRefsMaster ];
-    const QVector< int >& src1 = down ? revLookup( sha1 )->descRefs : revLookup( sha1 )->ancRefs;
-    const QVector< int >& src2 = down ? revLookup( sha2 )->descRefs : revLookup( sha2 )->ancRefs;
-    QVector< int > dst( src1 );
+    int cnt = fh->revOrder.count();
+    if( cnt == 0 || fh->isTopologyIndexed() )
+        return;
 
-    for( int s2 = 0; s2 < src2.count(); s2++ )
+    fh->parentsOfs.resize( cnt + 1 );
+    fh->parentRows.clear();
+    fh->parentRows.reserve( cnt + cnt / 8 );  // merges are a minority
+
+    for( int i = 0; i < cnt; i++ )
     {
-        bool add = false;
-        for( int s1 = 0; s1 < src1.count(); s1++ )
-        {
-            if( src2[ s2 ] == src1[ s1 ] )
-            {
-                add = false;
-                break;
-            }
-            QPair< uint, uint > key = qMakePair( ( uint )src2[ s2 ], ( uint )src1[ s1 ] );
+        const Rev* r = fh->revAt( i );
+        fh->parentsOfs[ i ] = fh->parentRows.count();
 
-            if( !dm.contains( key ) )
-            {                // Could be empty if all tags are independent
-                add = true;  // Could be an independent path
-                continue;
-            }
-            add = ( down && dm[ key ] ) || ( !down && !dm[ key ] );
-            if( add )
-                dst[ s1 ] = -1;  // Mark for removing
-            else
-                break;
+        for( uint y = 0; y < r->parentsCount(); y++ )
+        {
+            const Rev* p = revLookup( r->parent( y ), fh );
+            fh->parentRows.append( p ? p->orderIdx : -1 );
         }
-        if( add )
-            dst.append( src2[ s2 ] );
     }
-    QVector< int >& nearRefs = ( down ? p->descRefs : p->ancRefs );
-    int& nearRefsMaster = ( down ? p->descRefsMaster : p->ancRefsMaster );
+    fh->parentsOfs[ cnt ] = fh->parentRows.count();
+
+    //
+    // Count children of each row, then turn counts into offsets and fill
+    // them walking rows in order, so that children are sorted by row
+    //
+    const QVector< int >& pr = fh->parentRows;
+    QVector< int >& co = fh->childrenOfs;
+    co.fill( 0, cnt + 1 );
+    for( int y = 0; y < pr.count(); y++ )
+        if( pr[ y ] != -1 )
+            co[ pr[ y ] + 1 ]++;
 
-    nearRefs.clear();
-    for( int s2 = 0; s2 < dst.count(); s2++ )
-        if( dst[ s2 ] != -1 )
-            nearRefs.append( dst[ s2 ] );
+    for( int i = 0; i < cnt; i++ )
+        co[ i + 1 ] += co[ i ];
 
-    nearRefsMaster = p->orderIdx;
+    QVector< int > next( co );
+    fh->childRows.resize( co[ cnt ] );
+    for( int i = 0; i < cnt; i++ )
+        for( int y = fh->parentsOfs[ i ]; y < fh->parentsOfs[ i + 1 ]; y++ )
+            if( pr[ y ] != -1 )
+                fh->childRows[ next[ pr[ y ] ]++ ] = i;
 }
 
 void
 Git::indexTree()
 {
-    const ShaVect& ro = revData->revOrder;
-    if( ro.count() == 0 )
-        return;
-
     //
-    // We keep the pairs(x, y). Value is true if x is
-    // ancestor of y or false if y is ancestor of x
+    // Near refs are computed by a TreeIndexer in its own thread, on a
+    // snapshot of the graph and of the ref types, because on big histories
+    // that takes seconds. Results are published only once all done
     //
-    QHash< QPair< uint, uint >, bool > descMap;
-    QHash< uint, QVector< int > > descVect;
+    clearTreeIndexer();
+    FileHistory* fh = revData;
+    int cnt = fh->revOrder.count();
+    if( cnt == 0 )
+        return;
+
+    indexTopology( fh );  // No-op if already done
 
     //
-    // Walk down the tree from latest to oldest,
-    // compute children and nearest descendants
+    // Refs are far fewer than rows, so rows are found from refs
     //
-    for( uint i = 0, cnt = ro.count(); i < cnt; i++ )
+    QVector< uint > refTypes( cnt );
+    FOREACH( RefMap, it, refsShaMap )
     {
-        uint type = checkRef( ro[ i ] );
-        bool isB = ( type & ( BRANCH | RMT_BRANCH ) );
-        bool isT = ( type & TAG );
-
-        const Rev* r = revLookup( ro[ i ] );
-
-        if( isB )
-        {
-            Rev* rr = const_cast< Rev* >( r );
-            if( r->descBrnMaster != -1 )
-            {
-                const ShaString& sha = ro[ r->descBrnMaster ];
-                rr->descBranches = revLookup( sha )->descBranches;
-            }
-            rr->descBranches.append( i );
-        }
-        if( isT )
-        {
-            updateDescMap( r, i, descMap, descVect );
-            Rev* rr = const_cast< Rev* >( r );
-            rr->descRefs.clear();
-            rr->descRefs.append( i );
-        }
-        for( uint y = 0; y < r->parentsCount(); y++ )
-        {
-            Rev* p = const_cast< Rev* >( revLookup( r->parent( y ) ) );
-            if( p )
-            {
-                p->children.append( i );
+        const Rev* r = fh->revs.value( it.key() );
+        if( r && r->orderIdx < cnt && fh->revAt( r->orderIdx ) == r )
+            refTypes[ r->orderIdx ] = ( *it ).type;
+    }
 
-                if( p->descBrnMaster == -1 )
-                    p->descBrnMaster = isB ? r->orderIdx : r->descBrnMaster;
-                else
-                    mergeBranches( p, r );
+    treeIndexer = new TreeIndexer( this, fh, refTypes, optGoDown );
+    connect( treeIndexer, SIGNAL( indexed() ), this, SLOT( on_treeIndexed() ) );
+    treeIndexer->start( QThread::LowPriority );
+}
 
-                if( p->descRefsMaster == -1 )
-                    p->descRefsMaster = isT ? r->orderIdx : r->descRefsMaster;
-                else
-                    mergeNearTags( optGoDown, p, r, descMap );
-            }
-        }
-    }
+void
+Git::on_treeIndexed()
+{
+    if( !treeIndexer || !treeIndexer->isDone() )
+        return;  // Stale signal, indexing has been cancelled
 
-    //
-    // Walk backward through the tree and compute nearest tagged ancestors
-    //
-    for( int i = ro.count() - 1; i >= 0; i-- )
-    {
-        const Rev* r = revLookup( ro[ i ] );
-        bool isTag = checkRef( ro[ i ], TAG );
+    treeIndexer->publish( revData );
+    clearTreeIndexer();
+    emit treeIndexed();
+}
 
-        if( isTag )
-        {
-            Rev* rr = const_cast< Rev* >( r );
-            rr->ancRefs.clear();
-            rr->ancRefs.append( i );
-        }
-        for( int y = 0; y < r->children.count(); y++ )
-        {
-            Rev* c = const_cast< Rev* >( revLookup( ro[ r->children[ y ] ] ) );
-            if( c )
-            {
-                if( c->ancRefsMaster == -1 )
-                    c->ancRefsMaster = isTag ? r->orderIdx : r->ancRefsMaster;
-                else
-                    mergeNearTags( !optGoDown, c, r, descMap );
-            }
-        }
-    }
+void
+Git::clearTreeIndexer()
+{
+    delete treeIndexer;  // Cancels and waits for the thread
+    treeIndexer = NULL;
 }
@@ -7,19 +7,25 @@
 #ifndef GIT_H
 #define GIT_H
 
+#include <QPointer>
+
 #include "common.h"
 #include "exceptionmanager.h"
 
-template < class, class >
-struct QPair;
 class QRegExp;
 class QTextCodec;
 class Annotate;
 // class DataLoader;
+class DiffTreeLoader;
+class LongLogLoader;
 class Domain;
 class FileHistory;
 class Lanes;
 class MyProcess;
+struct FileNamesBatch;
+class FilesCache;
+struct RevCache;
+class TreeIndexer;
 
 class Git : public QObject
 {
@@ -28,15 +34,21 @@ class Git : public QObject
 
     friend class MainImpl;
     friend class DataLoader;
+    friend class DiffTreeLoader;
+    friend class LongLogLoader;
     friend class ConsoleImpl;
     friend class RevsView;
 
     Domain* curDomain;
     QString workDir;  // workDir is always without trailing '/'
     QString gitDir;
-    QString filesLoadingPending;
-    QString filesLoadingCurSha;
-    int filesLoadingStartOfs;
+    QVector< DiffTreeLoader* > diffTreeLoaders;  // one per 'git diff-tree' process
+    QVector< QPointer< MyProcess > > diffTreeProcs;  // feeding them, NULL once finished
+    int diffTreeMerged;                          // loaders already merged in revsFiles
+    TreeIndexer* treeIndexer;                    // running near refs computation, if any
+    QVector< LongLogLoader* > longLogLoaders;   // one per 'git log' reading log messages
+    QVector< QPointer< MyProcess > > longLogProcs;  // feeding them, NULL once finished
+    int filesLoadedCnt;                          // RevFile merged by current loading
     bool cacheNeedsUpdate;
     bool errorReportingEnabled;
     bool isMergeHead;
@@ -49,6 +61,7 @@ class Git : public QObject
     int patchesStillToFind;
     QString firstNonStGitPatch;
     RevFileMap revsFiles;
+    FilesCache* filesCache;  // records not yet in revsFiles are read from here
     QVector< QByteArray > revsFilesShaBackupBuf;
     QVector< QByteArray > shaBackupBuf;
     StrVect fileNamesVec;
@@ -56,6 +69,12 @@ class Git : public QObject
     QHash< QString, int > fileNamesMap;  // Quick lookup file name
     QHash< QString, int > dirNamesMap;   // Quick lookup directory name
     FileHistory* revData;
+    QString revCacheKey;   // loading arguments of main history
+    QString revCacheTips;  // loading arguments resolved to shas, one per line
+    RevCache* revCache;    // cached or kept revisions waiting to be spliced
+    bool loadingRevDelta;
+    bool revCacheNeedsUpdate;
+    int revCacheLanesEnd;  // rows with lanes already in cache, -1 if history not complete
 
     struct Reference
     {
@@ -102,32 +121,50 @@ class Git : public QObject
 
     struct FileNamesLoader
     {
-        FileNamesLoader() : rf( NULL ) {}
+        FileNamesLoader( bool l = false ) : rf( NULL ), local( l ) {}
         RevFile* rf;
         QVector< int > rfDirs;
         QVector< int > rfNames;
+        //
+        // A local loader interns names in its own dictionaries, so
+        // that it can be used out of the GUI thread, indices are
+        // remapped to the Git ones by mergeFileNames()
+        //
+        bool local;
+        StrVect dirNamesVec, fileNamesVec;
+        QHash< QByteArray, int > dirNamesMap, fileNamesMap;  // keyed by raw bytes
     };
-    FileNamesLoader fileLoader;
 
     void init2();
     bool run( SCRef cmd, QString* out = NULL, QObject* rcv = NULL, SCRef buf = "" );
     bool run( QByteArray* runOutput, SCRef cmd, QObject* rcv = NULL, SCRef buf = "" );
-    MyProcess* runAsync( SCRef cmd, QObject* rcv, SCRef buf = "" );
+    MyProcess* runAsync( SCRef cmd, QObject* rcv, SCRef buf = "", bool stdErr = true );
     MyProcess* runAsScript( SCRef cmd, QObject* rcv = NULL, SCRef buf = "" );
     const QStringList getArgs( bool* quit, bool repoChanged );
     bool getRefs();
     void parseStGitPatches( SCList patchNames, SCList patchShas );
     void clearRevs();
     void clearFileNames();
-    bool startRevList( SCList args, FileHistory* fh );
+    bool startRevList( SCList args, FileHistory* fh, SCRef buf = "" );
+    bool startCachedRevList( SCList args );
+    static bool isLimitedLoad( SCList args );
+    void spliceCachedRevs( bool withLanes );
+    RevCache* keepRevs();
+    void spliceKeptRevs( bool withLanes );
+    void saveRevCache();
+    const QByteArray lanesStateAt( FileHistory* fh, int row );
+    bool continueLanes( FileHistory* fh, int row, const QByteArray& state );
     bool startUnappliedList();
     bool startParseProc( SCList initCmd, FileHistory* fh, SCRef buf );
     bool tryFollowRenames( FileHistory* fh );
     bool populateRenamedPatches( SCRef sha, SCList nn, FileHistory* fh, QStringList* on, bool bt );
     bool filterEarlyOutputRev( FileHistory* fh, Rev* rev );
     int addChunk( FileHistory* fh, const QByteArray& ba, int ofs );
+    void addRev( FileHistory* fh, Rev* rev );
     void parseDiffFormat( RevFile& rf, SCRef buf, FileNamesLoader& fl );
     void parseDiffFormatLine( RevFile& rf, SCRef line, int parNum, FileNamesLoader& fl );
+    void parseDiffFormatLine( RevFile& rf, const char* line, int len, int parNum,
+                              FileNamesLoader& fl );
     void getDiffIndex();
     Rev* fakeRevData( SCRef sha, SCList parents, SCRef author, SCRef date, SCRef log, SCRef longLog,
                       SCRef patch, int idx, FileHistory* fh );
@@ -139,27 +176,41 @@ class Git : public QObject
     bool runDiffTreeWithRenameDetection( SCRef runCmd, QString* runOutput );
     bool isParentOf( SCRef par, SCRef child );
     bool isTreeModified( SCRef sha );
+    void indexTopology( FileHistory* fh );
     void indexTree();
-    void updateDescMap( const Rev* r, uint i, QHash< QPair< uint, uint >, bool >& dm,
-                        QHash< uint, QVector< int > >& dv );
-    void mergeNearTags( bool down, Rev* p, const Rev* r,
-                        const QHash< QPair< uint, uint >, bool >& dm );
-    void mergeBranches( Rev* p, const Rev* r );
-    void updateLanes( Rev& c, Lanes& lns, SCRef sha );
+    void clearTreeIndexer();
+    void updateLanes( Rev& c, Lanes& lns, const ShaString& sha, RevArena& arena );
     bool mkPatchFromWorkDir( SCRef msg, SCRef patchFile, SCList files );
     const QStringList getOthersFiles();
     const QStringList getOtherFiles( SCList selFiles, bool onlyInIndex );
     const QString getNewestFileName( SCList args, SCRef fileName );
     static const QString colorMatch( SCRef txt, QRegExp& regExp );
+    const RevFile* revFileLookup( const ShaString& sha );
+    bool hasRevFile( const ShaString& sha ) const;
     void appendFileName( RevFile& rf, SCRef name, FileNamesLoader& fl );
+    void appendFileName( RevFile& rf, const char* name, int len, FileNamesLoader& fl );
+    static int internName( SCRef name, StrVect& vec, QHash< QString, int >& map );
+    static int internName( const char* name, int len, StrVect& vec,
+                           QHash< QByteArray, int >& map );
+    void mergeFileNames( FileNamesBatch* b, QVector< int >& dirsRemap,
+                         QVector< int >& filesRemap );
+    void clearDiffTreeLoaders();
+    void longLogsTodo( const FileHistory* fh, int first, int last, const Rev* r,
+                       QVector< const Rev* >& todo, QString& buf );
+    bool loadLongLogs( const FileHistory* fh, int first, int last, const Rev* r );
+    static bool parseLongLogs( const FileHistory* fh, const QVector< const Rev* >& todo,
+                               int& done, const char*& data, const char* end, bool last );
     void flushFileNames( FileNamesLoader& fl );
     void populateFileNamesMap();
     const QString formatList( SCList sl, SCRef name, bool inOneLine = true );
+    static const QString formatPending( SCRef name );
+    const QStringList walkDescendantBranches( const Rev* r );
     static const QString quote( SCRef nm );
     static const QString quote( SCList sl );
     static const QStringList noSpaceSepHack( SCRef cmd );
     void removeDeleted( SCList selFiles );
     void setStatus( RevFile& rf, SCRef rowSt );
+    void setStatus( RevFile& rf, char status );
     void setExtStatus( RevFile& rf, SCRef rowSt, int parNum, FileNamesLoader& fl );
     void appendNamesWithId( QStringList& names, SCRef sha, SCList data, bool onlyLoaded );
     Reference* lookupReference( const ShaString& sha );
@@ -168,6 +219,9 @@ class Git : public QObject
 private slots:
     void loadFileCache();
     void loadFileNames();
+    void on_fileNamesReady();
+    void on_treeIndexed();
+    void on_longLogsLoaded();
     void on_runAsScript_eof();
     void on_getHighlightedFile_eof();
     void on_newDataReady( const FileHistory* );
@@ -198,6 +252,7 @@ public:
 
 public:
     explicit Git( QObject* parent );
+    ~Git();
 
     //
     // Used as self-documenting boolean parameters
@@ -221,7 +276,7 @@ public:
     void stop( bool saveCache );
     void setThrowOnStop( bool b );
     bool isThrowOnStopRaised( int excpId, SCRef curContext );
-    void setLane( SCRef sha, FileHistory* fh );
+    void setLanes( FileHistory* fh, int cnt );
     Annotate* startAnnotate( FileHistory* fh, QObject* guiObj );
     const FileAnnotation* lookupAnnotation( Annotate* ann, SCRef sha );
     void cancelAnnotate( Annotate* ann );
@@ -246,19 +301,25 @@ public:
                                    SCRef fileName );
     const QString getFileSha( SCRef file, SCRef revSha );
     bool saveFile( SCRef fileSha, SCRef fileName, SCRef path );
-    void getFileFilter( SCRef path, ShaSet& shaSet ) const;
+    void getFileFilter( SCRef path, ShaSet& shaSet );
     bool getPatchFilter( SCRef exp, bool isRegExp, ShaSet& shaSet );
     const RevFile* getFiles( SCRef sha, SCRef sha2 = "", bool all = false, SCRef path = "" );
     bool getTree( SCRef ts, TreeInfo& ti, bool wd, SCRef treePath );
     static const QString getLocalDate( SCRef gitDate );
+    static const QString getLocalDate( uint t );
     const QString getDesc( SCRef sha, QRegExp& slogRE, QRegExp& lLogRE, bool showH,
                            FileHistory* fh );
+    const QString getLongLog( const Rev* r, const FileHistory* fh );
+    bool prefetchLongLogs( const FileHistory* fh );
+    bool isLongLogPending( const Rev* r, const FileHistory* fh ) const;
+    void cancelLongLogs( const FileHistory* fh );
     const QString getLastCommitMsg();
     const QString getNewCommitMsg();
     const QString getLaneParent( SCRef fromSHA, int laneNum );
     const QStringList getChildren( SCRef parent );
-    const QStringList getNearTags( bool goDown, SCRef sha );
-    const QStringList getDescendantBranches( SCRef sha, bool shaOnly = false );
+    const QStringList getNearTags( bool goDown, SCRef sha, bool* pending = NULL );
+    const QStringList getDescendantBranches( SCRef sha, bool shaOnly = false,
+                                             bool* pending = NULL );
     const QString getShortLog( SCRef sha );
     const QString getTagMsg( SCRef sha );
     const Rev* revLookup( const ShaString& sha, const FileHistory* fh = NULL ) const;
@@ -303,11 +364,9 @@ signals:
     void cancelAllProcesses();
     void annotateReady( Annotate*, bool, const QString& );
     void fileNamesLoad( int, int );
+    void treeIndexed();
+    void longLogsLoaded();
     void changeFont( const QFont& );
-
-public slots:
-    void procReadyRead( const QByteArray& );
-    void procFinished();
 };
 
 #endif
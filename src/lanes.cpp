@@ -9,14 +9,14 @@
 #include "common.h"
 #include "lanes.h"
 
-#include <QStringList>
+#include <QDataStream>
 
 #define IS_NODE( x ) ( x == NODE || x == NODE_R || x == NODE_L )
 
 using namespace QGit;
 
 void
-Lanes::init( const QString& expectedSha )
+Lanes::init( const ShaString& expectedSha )
 {
     clear();
     activeLane = 0;
@@ -28,7 +28,13 @@ void
 Lanes::clear()
 {
     typeVec.clear();
-    nextShaVec.clear();
+    nextVec.clear();
+    ids.clear();
+    shas.clear();
+    lanesCnt.clear();
+    freeIds.clear();
+    shaBuf.clear();
+    prevLanes.clear();
 }
 
 void
@@ -47,14 +53,15 @@ Lanes::setBoundary( bool b )
 }
 
 bool
-Lanes::isFork( const QString& sha, bool& isDiscontinuity )
+Lanes::isFork( const ShaString& sha, bool& isDiscontinuity )
 {
-    int pos = findNextSha( sha, 0 );
+    int id = idOf( sha );
+    int pos = ( id != -1 ? findNextId( id, 0 ) : -1 );
     isDiscontinuity = ( activeLane != pos );
     if( pos == -1 )  // New branch case
         return false;
 
-    return ( findNextSha( sha, pos + 1 ) != -1 );
+    return ( lanesCnt[ id ] > 1 );
     /*
         int cnt = 0;
         while (pos != -1) {
@@ -68,16 +75,17 @@ Lanes::isFork( const QString& sha, bool& isDiscontinuity )
 }
 
 void
-Lanes::setFork( const QString& sha )
+Lanes::setFork( const ShaString& sha )
 {
     int rangeStart, rangeEnd, idx;
-    rangeStart = rangeEnd = idx = findNextSha( sha, 0 );
+    int id = idOf( sha );  // Valid, we are called after isFork()
+    rangeStart = rangeEnd = idx = findNextId( id, 0 );
 
     while( idx != -1 )
     {
         rangeEnd = idx;
         typeVec[ idx ] = TAIL;
-        idx = findNextSha( sha, idx + 1 );
+        idx = findNextId( id, idx + 1 );
     }
     typeVec[ activeLane ] = NODE;
 
@@ -109,7 +117,7 @@ Lanes::setFork( const QString& sha )
 }
 
 void
-Lanes::setMerge( const QStringList& parents )
+Lanes::setMerge( const ShaVect& parents )
 {
     //
     // setFork() must be called before setMerge()
@@ -126,13 +134,14 @@ Lanes::setMerge( const QStringList& parents )
     t = NODE;
 
     int rangeStart = activeLane, rangeEnd = activeLane;
-    QStringList::const_iterator it( parents.constBegin() );
+    ShaVect::const_iterator it( parents.constBegin() );
     for( ++it; it != parents.constEnd(); ++it )
     {
         //
         // Skip first parent
         //
-        int idx = findNextSha( *it, 0 );
+        int id = idOf( *it );
+        int idx = ( id != -1 ? findNextId( id, 0 ) : -1 );
         if( idx != -1 )
         {
             if( idx > rangeEnd )
@@ -206,7 +215,7 @@ Lanes::setApplied()
 }
 
 void
-Lanes::changeActiveLane( const QString& sha )
+Lanes::changeActiveLane( const ShaString& sha )
 {
     int& t = typeVec[ activeLane ];
     if( t == INITIAL || isBoundary( t ) )
@@ -214,7 +223,8 @@ Lanes::changeActiveLane( const QString& sha )
     else
         t = NOT_ACTIVE;
 
-    int idx = findNextSha( sha, 0 );  // Find first sha
+    int id = idOf( sha );
+    int idx = ( id != -1 ? findNextId( id, 0 ) : -1 );  // Find first sha
     if( idx != -1 )
         typeVec[ idx ] = ACTIVE;  // Called before setBoundary()
     else
@@ -262,8 +272,9 @@ Lanes::afterFork()
     }
     while( typeVec.last() == EMPTY )
     {
+        releaseNext( typeVec.count() - 1 );
         typeVec.pop_back();
-        nextShaVec.pop_back();
+        nextVec.pop_back();
     }
 }
 
@@ -286,16 +297,83 @@ Lanes::afterApplied()
 }
 
 void
-Lanes::nextParent( const QString& sha )
+Lanes::nextParent( const ShaString& sha )
 {
-    nextShaVec[ activeLane ] = ( boundary ? "" : sha );
+    setNext( activeLane, ( boundary ? ShaString() : sha ) );
+}
+
+void
+Lanes::getLanes( RevLanes& ln, RevArena& arena )
+{
+    //
+    // Snapshot current row in compact form, see RevLanes
+    //
+    QByteArray row( typeVec.count(), Qt::Uninitialized );
+    char* d = row.data();
+    for( int i = 0; i < typeVec.count(); i++ )
+        d[ i ] = ( char )typeVec[ i ];
+
+    ln.assign( row, prevLanes, arena );
+    prevLanes = ln;
 }
 
 int
-Lanes::findNextSha( const QString& next, int pos )
+Lanes::idOf( const ShaString& sha ) const
+{
+    return ( sha.latin1() ? ids.value( sha, -1 ) : -1 );
+}
+
+void
+Lanes::releaseNext( int pos )
 {
-    for( int i = pos; i < nextShaVec.count(); i++ )
-        if( nextShaVec[ i ] == next )
+    int id = nextVec[ pos ];
+    if( id == -1 || --lanesCnt[ id ] > 0 )
+        return;
+
+    ids.remove( shas[ id ] );
+    freeIds.append( id );
+}
+
+void
+Lanes::setNext( int pos, const ShaString& sha )
+{
+    //
+    // Intern sha, the returned id is valid until
+    // there is at least one lane waiting for it
+    //
+    releaseNext( pos );
+    if( !sha.latin1() )
+    {
+        nextVec[ pos ] = -1;  // Initial or boundary revision
+        return;
+    }
+    int id = ids.value( sha, -1 );
+    if( id == -1 )
+    {
+        if( !freeIds.isEmpty() )
+        {
+            id = freeIds.last();
+            freeIds.pop_back();
+            shas[ id ] = sha;
+        }
+        else
+        {
+            id = shas.count();
+            shas.append( sha );
+            lanesCnt.append( 0 );
+        }
+        ids.insert( sha, id );
+    }
+    lanesCnt[ id ]++;
+    nextVec[ pos ] = id;
+}
+
+int
+Lanes::findNextId( int id, int pos )
+{
+    const int* v = nextVec.constData();
+    for( int i = pos, cnt = nextVec.count(); i < cnt; i++ )
+        if( v[ i ] == id )
             return i;
     return -1;
 }
@@ -310,7 +388,7 @@ Lanes::findType( int type, int pos )
 }
 
 int
-Lanes::add( int type, const QString& next, int pos )
+Lanes::add( int type, const ShaString& next, int pos )
 {
     //
     // First check empty lanes starting from pos
@@ -321,7 +399,7 @@ Lanes::add( int type, const QString& next, int pos )
         if( pos != -1 )
         {
             typeVec[ pos ] = type;
-            nextShaVec[ pos ] = next;
+            setNext( pos, next );
             return pos;
         }
     }
@@ -329,6 +407,56 @@ Lanes::add( int type, const QString& next, int pos )
     // If all lanes are occupied add a new lane
     //
     typeVec.append( type );
-    nextShaVec.append( next );
+    nextVec.append( -1 );
+    setNext( nextVec.count() - 1, next );
     return typeVec.count() - 1;
 }
+
+//
+// Lanes streaming out
+//
+const Lanes&
+Lanes::operator>>( QDataStream& stream ) const
+{
+    //
+    // Ids are meaningful only here, stream the shas
+    //
+    QVector< QString > nextShaVec;
+    FOREACH( QVector< int >, it, nextVec )
+    nextShaVec.append( *it != -1 ? QString( shas[ *it ] ) : QString() );
+
+    stream << ( qint32 )activeLane << typeVec << nextShaVec;
+    stream << ( quint32 )boundary;
+    return *this;
+}
+
+//
+// Lanes streaming in
+//
+Lanes&
+Lanes::operator<<( QDataStream& stream )
+{
+    qint32 al;
+    quint32 b;
+    QVector< int > types;
+    QVector< QString > nextShaVec;
+    stream >> al >> types >> nextShaVec >> b;
+
+    clear();
+    typeVec = types;
+    nextVec.fill( -1, nextShaVec.count() );
+    for( int i = 0; i < nextShaVec.count(); i++ )
+        if( !nextShaVec[ i ].isEmpty() )
+            setNext( i, toPersistentSha( nextShaVec[ i ], shaBuf ) );
+
+    activeLane = al;
+    boundary = ( bool )b;
+
+    //
+    // Restore node types, boundary lane type is already in typeVec
+    //
+    NODE = boundary ? BOUNDARY_C : MERGE_FORK;
+    NODE_R = boundary ? BOUNDARY_R : MERGE_FORK_R;
+    NODE_L = boundary ? BOUNDARY_L : MERGE_FORK_L;
+    return *this;
+}
@@ -7,15 +7,18 @@
 #ifndef LANES_H
 #define LANES_H
 
+#include <QHash>
 #include <QString>
 #include <QVector>
 
-class QStringList;
+#include "common.h"
+
+class QDataStream;
 
 //
 //  At any given time, the Lanes class represents a single revision (row) of the history graph.
-//  The Lanes class contains a vector of the sha1 hashes of the next commit to appear in each lane
-//  (column).
+//  The Lanes class contains a vector of the ids of the next commit to appear in each lane
+//  (column), ids are sha1 hashes interned as small integers.
 //  The Lanes class also contains a vector used to decide which glyph to draw on the history graph.
 //
 //  For each revision (row) (from recent (top) to ancient past (bottom)), the Lanes class is
@@ -33,41 +36,55 @@ class Lanes
     //
     QVector< int > typeVec;
     //
-    // The sha1 hashes of the next commit to appear in each lane (column)
+    // The id of the next commit to appear in each lane (column), -1 if none.
+    // Only the shas waited by some lane have an id, so the lookup of any
+    // other sha fails at once, with no scan of the lanes
     //
-    QVector< QString > nextShaVec;
+    QVector< int > nextVec;
+    QHash< ShaString, int > ids;    // sha -> id
+    QVector< ShaString > shas;      // id -> sha
+    QVector< int > lanesCnt;        // number of lanes with this id, 0 if id is free
+    QVector< int > freeIds;
+    QVector< QByteArray > shaBuf;   // storage for shas streamed in
+    RevLanes prevLanes;             // last snapshot, next ones are encoded against it
     bool boundary;
     int NODE, NODE_L, NODE_R;
 
 private:
-    int findNextSha( const QString& next, int pos );
+    int idOf( const ShaString& sha ) const;
+    void setNext( int pos, const ShaString& sha );
+    void releaseNext( int pos );
+    int findNextId( int id, int pos );
     int findType( int type, int pos );
-    int add( int type, const QString& next, int pos );
+    int add( int type, const ShaString& next, int pos );
 
 public:
     Lanes() {}  // NOTE: init() will setup us later, when data become available
 
     bool isEmpty() { return typeVec.empty(); }
-    void init( const QString& expectedSha );
+    void init( const ShaString& expectedSha );
     void clear();
-    bool isFork( const QString& sha, bool& isDiscontinuity );
+    bool isFork( const ShaString& sha, bool& isDiscontinuity );
     void setBoundary( bool isBoundary );
-    void setFork( const QString& sha );
-    void setMerge( const QStringList& parents );
+    void setFork( const ShaString& sha );
+    void setMerge( const ShaVect& parents );
     void setInitial();
     void setApplied();
-    void changeActiveLane( const QString& sha );
+    void changeActiveLane( const ShaString& sha );
     void afterMerge();
     void afterFork();
     bool isBranch();
     void afterBranch();
     void afterApplied();
-    void nextParent( const QString& sha );
-    
+    void nextParent( const ShaString& sha );
+
+    void getLanes( RevLanes& ln, RevArena& arena );
+
     //
-    // NOTE: O(1) vector is implicitly shared
+    // Lanes state streaming, used by the revisions cache
     //
-    void getLanes( QVector< int >& ln ) { ln = typeVec; }
+    const Lanes& operator>>( QDataStream& ) const;
+    Lanes& operator<<( QDataStream& );
 };
 
 #endif
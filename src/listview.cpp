@@ -32,7 +32,7 @@ ListView::setup( Domain* dm, Git* g )
     git = g;
     fh = d->model();
     st = &( d->st );
-    filterNextContextMenuRequest = false;
+    filterNextContextMenuRequest = restoreSelection = false;
 
     setFont( QGit::STD_FONT );
 
@@ -61,6 +61,9 @@ ListView::setup( Domain* dm, Git* g )
 
     connect( this, SIGNAL( customContextMenuRequested( const QPoint& ) ), this,
              SLOT( on_customContextMenuRequested( const QPoint& ) ) );
+
+    connect( fh, SIGNAL( rowsInserted( const QModelIndex&, int, int ) ), this,
+             SLOT( on_rowsInserted() ) );
 }
 
 ListView::~ListView()
@@ -283,6 +286,15 @@ ListView::update()
 void
 ListView::currentChanged( const QModelIndex& index, const QModelIndex& )
 {
+    if( fh->isFlushingTail() )
+    {
+        //
+        // Selected row has been removed by early output reconciliation,
+        // keep the selected revision, it will be back with final output
+        //
+        restoreSelection = true;
+        return;
+    }
     SCRef selRev = sha( index.row() );
     if( st->sha() != selRev )
     {
@@ -295,6 +307,13 @@ ListView::currentChanged( const QModelIndex& index, const QModelIndex& )
     }
 }
 
+void
+ListView::on_rowsInserted()
+{
+    if( restoreSelection && update() )
+        restoreSelection = false;
+}
+
 bool
 ListView::filterRightButtonPressed( QMouseEvent* e )
 {
@@ -501,7 +520,10 @@ ListViewDelegate::revLookup( int row, FileHistory** fhPtr ) const
     if( fhPtr )
         *fhPtr = fh;
 
-    return git->revLookup( lv->sha( row ), fh );
+    if( lp->sourceModel() )  // Painted rows are proxy rows
+        row = lp->mapToSource( lp->index( row, 0 ) ).row();
+
+    return fh->rev( row );
 }
 
 static QColor
@@ -722,8 +744,7 @@ ListViewDelegate::paintGraph( QPainter* p, const QStyleOptionViewItem& opt,
     else
         p->fillRect( opt.rect, opt.palette.base() );
 
-    FileHistory* fh;
-    const Rev* r = revLookup( i.row(), &fh );
+    const Rev* r = revLookup( i.row() );
     if( !r )
         return;
 
@@ -731,14 +752,8 @@ ListViewDelegate::paintGraph( QPainter* p, const QStyleOptionViewItem& opt,
     p->setClipRect( opt.rect, Qt::IntersectClip );
     p->translate( opt.rect.topLeft() );
 
-    //
-    // Calculate lanes
-    //
-    if( r->lanes.count() == 0 )
-        git->setLane( r->sha(), fh );
-
     QBrush back = opt.palette.base();
-    const QVector< int >& lanes( r->lanes );
+    const QByteArray lanes( r->lanes.decode() );  // Decode once per row
     uint laneNum = lanes.count();
     uint activeLane = 0;
     for( uint i = 0; i < laneNum; i++ )
@@ -929,7 +944,7 @@ ListViewProxy::ListViewProxy( QObject* p, Domain* dm, Git* g ) : QSortFilterProx
 }
 
 bool
-ListViewProxy::isMatch( SCRef sha ) const
+ListViewProxy::isMatch( SCRef sha, int row ) const
 {
     if( colNum == SHA_MAP_COL )
     {
@@ -939,21 +954,18 @@ ListViewProxy::isMatch( SCRef sha ) const
         return shaSet.contains( sha );
     }
 
-    const Rev* r = git->revLookup( sha );
-    if( !r )
+    //
+    // Decoded texts are cached by the model, filtering again
+    // the same rows, as while typing, does not decode them
+    //
+    QString target;
+    if( colNum == COMMIT_COL )
+        target = sha;
+    else if( !d->model()->rowText( row, colNum, target ) )
     {
         dbp( "ASSERT in ListViewFilter::isMatch, sha <%1> not found", sha );
         return false;
     }
-    QString target;
-    if( colNum == LOG_COL )
-        target = r->shortLog();
-    else if( colNum == AUTH_COL )
-        target = r->author();
-    else if( colNum == LOG_MSG_COL )
-        target = r->longLog();
-    else if( colNum == COMMIT_COL )
-        target = sha;
 
     //
     // Wildcard search, case insensitive
@@ -969,7 +981,7 @@ ListViewProxy::isMatch( int source_row ) const
         return false;
 
     bool extFilter = ( colNum == -1 );
-    return ( ( !extFilter && isMatch( fh->sha( source_row ) ) ) ||
+    return ( ( !extFilter && isMatch( fh->sha( source_row ), source_row ) ) ||
              ( extFilter && d->isMatch( fh->sha( source_row ) ) ) );
 }
 
@@ -1006,11 +1018,20 @@ ListViewProxy::setFilter( bool isOn, bool h, SCRef fl, int cn, ShaSet* s )
     ListView* lv = static_cast< ListView* >( parent() );
     FileHistory* fh = d->model();
 
+    //
+    // Log messages are read in background, all at once, not row by row.
+    // Rows still to be read do not match, filter is set again when done
+    //
+    if( isOn && colNum == LOG_MSG_COL )
+        git->prefetchLongLogs( fh );
+
     if( !isOn && sourceModel() )
     {
         lv->setModel( fh );
         setSourceModel( NULL );
     }
+    else if( isOn && !isHighLight && sourceModel() == fh )
+        invalidateFilter();  // Set again, see MainImpl::longLogsLoaded()
     else if( isOn && !isHighLight )
     {
         setSourceModel( fh );  // Trigger a rows scanning
@@ -30,6 +30,7 @@ class ListView : public QTreeView
     ListViewProxy* lp;
     unsigned long secs;
     bool filterNextContextMenuRequest;
+    bool restoreSelection;
 
     void setupGeometry();
     bool filterRightButtonPressed( QMouseEvent* e );
@@ -46,6 +47,7 @@ protected:
 
 private slots:
     void on_customContextMenuRequested( const QPoint& );
+    void on_rowsInserted();
     virtual void currentChanged( const QModelIndex&, const QModelIndex& );
 
 public:
@@ -125,7 +127,7 @@ class ListViewProxy : public QSortFilterProxyModel
     ShaSet shaSet;
 
     bool isMatch( int row ) const;
-    bool isMatch( SCRef sha ) const;
+    bool isMatch( SCRef sha, int row ) const;
 
 protected:
     virtual bool filterAcceptsRow( int sourceRow, const QModelIndex& sourceParent ) const;
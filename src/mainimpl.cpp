@@ -179,6 +179,10 @@ MainImpl::MainImpl( SCRef cd, QWidget* p ) : QMainWindow( p )
 
     connect( git, SIGNAL( fileNamesLoad( int, int ) ), this, SLOT( fileNamesLoad( int, int ) ) );
 
+    connect( git, SIGNAL( treeIndexed() ), this, SIGNAL( updateRevDesc() ) );
+
+    connect( git, SIGNAL( longLogsLoaded() ), this, SLOT( longLogsLoaded() ) );
+
     connect( git, SIGNAL( newRevsAdded( const FileHistory*, const QVector< ShaString >& ) ),
              this, SLOT( newRevsAdded( const FileHistory*, const QVector< ShaString >& ) ) );
 
@@ -859,6 +863,21 @@ MainImpl::ActSearchAndHighlight_toggled( bool isOn )
     ActSearchAndHighlight->setEnabled( true );
 }
 
+void
+MainImpl::longLogsLoaded()
+{
+    emit updateRevDesc();  // Current one could have been waiting
+
+    //
+    // Log messages filter did not match the rows whose
+    // message was still to be read, set it again
+    //
+    bool isFilter = ActSearchAndFilter->isChecked();
+    bool isOn = ( isFilter || ActSearchAndHighlight->isChecked() );
+    if( isOn && cmbSearch->currentIndex() == CS_LOG_MSG )
+        filterList( true, !isFilter );
+}
+
 void
 MainImpl::filterList( bool isOn, bool onlyHighlight )
 {
@@ -93,6 +93,7 @@ private slots:
     void tabWdg_currentChanged( int );
     void newRevsAdded( const FileHistory*, const QVector< ShaString >& );
     void fileNamesLoad( int, int );
+    void longLogsLoaded();
     void revisionsDragged( const QStringList& );
     void revisionsDropped( const QStringList& );
     void shortCutActivated();
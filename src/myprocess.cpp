@@ -23,12 +23,14 @@ MyProcess::MyProcess( QObject* go, Git* g, const QString& wd, bool err ) : QProc
     receiver = NULL;
     errorReportingEnabled = err;
     canceling = async = isWinShell = isErrorExit = false;
+    withStderr = true;
 }
 
 bool
-MyProcess::runAsync( SCRef rc, QObject* rcv, SCRef buf )
+MyProcess::runAsync( SCRef rc, QObject* rcv, SCRef buf, bool stdErr )
 {
     async = true;
+    withStderr = stdErr;
     runCmd = rc;
     receiver = rcv;
     setupSignals();
@@ -83,8 +85,13 @@ MyProcess::setupSignals()
 
     if( receiver )
     {
-        connect( this, SIGNAL( readyReadStandardError() ), this,
-                 SLOT( on_readyReadStandardError() ) );
+        //
+        // Without stderr forwarding it is left to on_finished(),
+        // so that errors are reported and output is not mixed up
+        //
+        if( withStderr )
+            connect( this, SIGNAL( readyReadStandardError() ), this,
+                     SLOT( on_readyReadStandardError() ) );
 
         connect( this, SIGNAL( procDataReady( const QByteArray& ) ), receiver,
                  SLOT( procReadyRead( const QByteArray& ) ) );
@@ -33,6 +33,7 @@ class MyProcess : public QProcess
     bool async;
     bool isWinShell;
     bool isErrorExit;
+    bool withStderr;  // stderr is sent to receiver too
 
     void setupSignals();
     bool launchMe( SCRef runCmd, SCRef buf );
@@ -48,7 +49,7 @@ public:
     MyProcess( QObject* go, Git* g, const QString& wd, bool reportErrors );
 
     bool runSync( SCRef runCmd, QByteArray* runOutput, QObject* rcv, SCRef buf );
-    bool runAsync( SCRef rc, QObject* rcv, SCRef buf );
+    bool runAsync( SCRef rc, QObject* rcv, SCRef buf, bool stdErr = true );
     static const QStringList splitArgList( SCRef cmd );
 
 signals:
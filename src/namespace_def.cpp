@@ -227,6 +227,8 @@ const QString QGit::EXT_DIFF_DEF = "kompare";
 //
 const QString QGit::BAK_EXT = ".bak";
 const QString QGit::C_DAT_FILE = "/qgit_cache.dat";
+const QString QGit::C_JNL_FILE = "/qgit_cache.jnl";
+const QString QGit::R_DAT_FILE = "/qgit_revs.dat";
 
 //
 // Misc